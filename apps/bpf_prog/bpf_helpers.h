@@ -13,6 +13,14 @@
 
 #define bpf_notify ((void (*)(__u64 function_address))8)
 #define bpf_get_ret_addr ((__u64(*)(const char *function_name))9)
+#define bpf_tail_call ((__u64(*)(void *ctx, __u64 index))10)
+#define bpf_probe_read_bytes ((__u64(*)(void *dst, __u64 size, __u64 src))11)
+#define bpf_read_pmc ((__u64(*)(__u64 idx))12)
+#define bpf_get_stack ((__u64(*)(void *buf, __u64 size))13)
+#define bpf_get_stackid ((__u64(*)(__u64 max_depth))14)
+#define bpf_printk                                                             \
+	((__u64(*)(const char *fmt, __u64 arg1, __u64 arg2, __u64 arg3,       \
+		   __u64 arg4))15)
 
 #define UINT64_MAX 0xffffffffffffffffULL
 
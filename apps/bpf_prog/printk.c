@@ -0,0 +1,23 @@
+#include "bpf_helpers.h"
+
+// example:
+// > bpf_attach sqlite3_exec printk.bin
+// records every call with the number of calls so far, bpf_trace_print
+// prints them
+
+#define CALLS_KEY 4
+
+int bpf_prog(void *arg)
+{
+	struct UbpfTracerCtx *ctx = arg;
+	// only .text is loaded, so the format is built on the stack
+	char fmt[] = {'%', 'l', 'x', ':', ' ', 'c', 'a', 'l', 'l',
+		      ' ', '%', 'l', 'u', '\0'};
+
+	__u64 calls = bpf_map_get(ctx->traced_function_address, CALLS_KEY);
+	if (calls == UINT64_MAX)
+		calls = 0;
+	bpf_map_put(ctx->traced_function_address, CALLS_KEY, ++calls);
+	bpf_printk(fmt, ctx->traced_function_address, calls, 0, 0);
+	return 0;
+}
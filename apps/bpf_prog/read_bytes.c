@@ -0,0 +1,29 @@
+#include "bpf_helpers.h"
+
+// example:
+// > bpf_exec read_bytes.bin count
+// returns the sum of the first 64 bytes at the symbol
+
+int bpf_prog(void *arg)
+{
+	__u64 addr = bpf_get_addr((const char*)arg);
+
+	if (addr == 0) {
+		char errmsg[] = "symbol not found\n";
+		bpf_puts(&errmsg[0]);
+		return -1;
+	}
+
+	__u64 buf[8];
+	if (bpf_probe_read_bytes(&buf[0], sizeof(buf), addr) != 0) {
+		char errmsg[] = "read failed\n";
+		bpf_puts(&errmsg[0]);
+		return -1;
+	}
+
+	__u64 sum = 0;
+	for (int i = 0; i < 8; i++) {
+		sum += buf[i];
+	}
+	return sum;
+}
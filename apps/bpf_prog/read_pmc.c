@@ -0,0 +1,27 @@
+#include "bpf_helpers.h"
+
+// example:
+// > bpf_attach sqlite3BtreeNext read_pmc.bin
+// accumulates the LLC misses between consecutive calls of the traced
+// function, counter 1 has to be set up with pmu_enable_llc_misses(1)
+
+#define PMC_LLC_MISSES 1
+#define LAST_KEY 1
+#define SUM_KEY 2
+
+int bpf_prog(void *arg)
+{
+	struct UbpfTracerCtx *ctx = arg;
+	__u64 now = bpf_read_pmc(PMC_LLC_MISSES);
+	__u64 last = bpf_map_get(ctx->traced_function_address, LAST_KEY);
+
+	if (last != UINT64_MAX && now >= last) {
+		__u64 sum = bpf_map_get(ctx->traced_function_address, SUM_KEY);
+		if (sum == UINT64_MAX)
+			sum = 0;
+		bpf_map_put(ctx->traced_function_address, SUM_KEY,
+			    sum + now - last);
+	}
+	bpf_map_put(ctx->traced_function_address, LAST_KEY, now);
+	return 0;
+}
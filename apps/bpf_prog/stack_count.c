@@ -0,0 +1,21 @@
+#include "bpf_helpers.h"
+
+// example:
+// > bpf_attach sqlite3_exec stack_count.bin
+// counts the call paths leading to the traced function, bpf_stacks(3)
+// prints them as folded stacks for flamegraph.pl
+
+#define STACK_COUNT_KEY 3
+
+int bpf_prog(void *arg)
+{
+	__u64 id = bpf_get_stackid(0);
+	if (id == UINT64_MAX)
+		return 1;
+
+	__u64 count = bpf_map_get(STACK_COUNT_KEY, id);
+	if (count == UINT64_MAX)
+		count = 0;
+	bpf_map_put(STACK_COUNT_KEY, id, count + 1);
+	return 0;
+}
@@ -0,0 +1,28 @@
+#include "bpf_helpers.h"
+
+#define CALL_COUNT_KEY 1
+#define NEXT_PROG 0
+
+static __attribute__((noinline)) void count_call(__u64 function_address);
+
+// The entry point must come first in .text
+int bpf_prog(void *arg)
+{
+	struct UbpfTracerCtx *ctx = arg;
+	count_call(ctx->traced_function_address);
+
+	// continue in prog_array[NEXT_PROG]; only returns if it is not set
+	bpf_tail_call(arg, NEXT_PROG);
+
+	return 0;
+}
+
+// BPF-to-BPF call, with its own stack frame
+static __attribute__((noinline)) void count_call(__u64 function_address)
+{
+	__u64 count = bpf_map_get(function_address, CALL_COUNT_KEY);
+	if (count == UINT64_MAX) {
+		count = 0;
+	}
+	bpf_map_put(function_address, CALL_COUNT_KEY, count + 1);
+}
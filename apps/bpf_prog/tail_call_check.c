@@ -0,0 +1,27 @@
+#include "bpf_helpers.h"
+
+// Conformance check for bpf_tail_call, together with tail_call_check_next.c:
+// > bpf_prog_array_set 1 tail_call_check_next.bin
+// > bpf_exec tail_call_check.bin
+// BPF program returned: 32
+// Any other result is the number of the failed check (1000 + n).
+
+#define CHECK_KEY 0x7a11ca11
+#define EMPTY_PROG 7
+#define NEXT_PROG 1
+
+int bpf_prog(void *arg)
+{
+	// an empty slot returns -1 and the program continues
+	if (bpf_tail_call(arg, EMPTY_PROG) != UINT64_MAX) {
+		return 1001;
+	}
+
+	// tail_call_check_next counts its runs and checks the context
+	bpf_map_put(CHECK_KEY, 0, 0);
+	bpf_map_put(CHECK_KEY, 1, (__u64)arg);
+	bpf_tail_call(arg, NEXT_PROG);
+
+	// only reached if prog_array[NEXT_PROG] is not set
+	return 1002;
+}
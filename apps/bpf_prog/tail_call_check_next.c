@@ -0,0 +1,27 @@
+#include "bpf_helpers.h"
+
+// Target of tail_call_check.c, stored in prog_array[1]. It tail calls itself
+// until UBPF_MAX_TAIL_CALLS (32) chained calls are reached, then the call
+// fails and it returns the number of its runs.
+
+#define CHECK_KEY 0x7a11ca11
+#define NEXT_PROG 1
+
+int bpf_prog(void *arg)
+{
+	// r1 is kept across the tail call
+	if ((__u64)arg != bpf_map_get(CHECK_KEY, 1)) {
+		return 1004;
+	}
+
+	__u64 runs = bpf_map_get(CHECK_KEY, 0) + 1;
+	bpf_map_put(CHECK_KEY, 0, runs);
+	if (runs > 32) {
+		return 1005;
+	}
+
+	bpf_tail_call(arg, NEXT_PROG);
+
+	// the chain is bounded: the call after the 32nd one fails
+	return runs;
+}
@@ -0,0 +1,106 @@
+#ifndef _LATENCY_HIST_H
+#define _LATENCY_HIST_H
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * HDR-style latency histogram: values below 2^LATENCY_HIST_SUB_BITS are
+ * counted exactly, larger ones in 2^LATENCY_HIST_SUB_BITS linear sub-buckets
+ * per power of two, i.e. with a relative error below 1%. Values are in ns
+ * and saturate at 2^LATENCY_HIST_MAX_BITS (~18 minutes).
+ *
+ * The summary printed by latency_hist_print() is one line
+ *   hist <name> count=<n> min=<ns> p50=<ns> ... max=<ns>
+ * which misc/tests/measure_helpers.py (parse_latency_hist) reads back.
+ */
+#define LATENCY_HIST_SUB_BITS 7
+#define LATENCY_HIST_SUB (1ULL << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS 40
+#define LATENCY_HIST_BUCKETS \
+	((LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) * LATENCY_HIST_SUB)
+
+struct latency_hist {
+	unsigned long long count;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long sum;
+	unsigned long long buckets[LATENCY_HIST_BUCKETS];
+};
+
+static inline void latency_hist_reset(struct latency_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = ~0ULL;
+}
+
+static inline unsigned int latency_hist_index(unsigned long long v)
+{
+	unsigned int shift;
+
+	if (v < LATENCY_HIST_SUB)
+		return v;
+	if (v >= 1ULL << LATENCY_HIST_MAX_BITS)
+		return LATENCY_HIST_BUCKETS - 1;
+	shift = 63 - __builtin_clzll(v) - LATENCY_HIST_SUB_BITS;
+	return (shift + 1) * LATENCY_HIST_SUB
+	       + ((v >> shift) - LATENCY_HIST_SUB);
+}
+
+// highest value that is counted in bucket i
+static inline unsigned long long latency_hist_value(unsigned int i)
+{
+	unsigned int shift;
+
+	if (i < LATENCY_HIST_SUB)
+		return i;
+	shift = i / LATENCY_HIST_SUB - 1;
+	return ((LATENCY_HIST_SUB + i % LATENCY_HIST_SUB) << shift)
+	       + (1ULL << shift) - 1;
+}
+
+static inline void latency_hist_record(struct latency_hist *h,
+				       unsigned long long v)
+{
+	h->buckets[latency_hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+// value at or below which permille/1000 of the recorded values are
+static inline unsigned long long
+latency_hist_percentile(const struct latency_hist *h, unsigned int permille)
+{
+	unsigned long long rank, seen = 0;
+
+	if (h->count == 0)
+		return 0;
+	rank = (h->count * permille + 999) / 1000;
+	if (rank == 0)
+		rank = 1;
+	for (unsigned int i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return latency_hist_value(i) < h->max
+				   ? latency_hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+static inline void latency_hist_print(const struct latency_hist *h,
+				      const char *name)
+{
+	printf("hist %s count=%llu min=%llu mean=%llu p50=%llu p90=%llu "
+	       "p99=%llu p99.9=%llu max=%llu\n",
+	       name, h->count, h->count ? h->min : 0,
+	       h->count ? h->sum / h->count : 0,
+	       latency_hist_percentile(h, 500), latency_hist_percentile(h, 900),
+	       latency_hist_percentile(h, 990), latency_hist_percentile(h, 999),
+	       h->max);
+}
+
+#endif /* _LATENCY_HIST_H */
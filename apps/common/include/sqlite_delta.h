@@ -0,0 +1,545 @@
+#ifndef _SQLITE_DELTA_H
+#define _SQLITE_DELTA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <uk/essentials.h>
+
+/*
+ * Delta snapshots of an in-memory database.
+ *
+ * The database is opened on the "memdelta" VFS (sqlite_delta_open()) instead
+ * of ":memory:". The VFS keeps its files in memory, like ":memory:", and
+ * marks every SQLITE_DELTA_CHUNK bytes of the main database that are written.
+ * Unlike ":memory:" each page is kept twice, in the VFS and in the page
+ * cache, so only use it when delta snapshots are wanted.
+ * sqlite_delta_save() appends only the chunks written since the previous
+ * snapshot to an append-only delta file, so a checkpoint costs I/O in
+ * proportion to the writes instead of the database size. The first snapshot
+ * contains the whole database.
+ *
+ * Delta file (little endian):
+ *   header:   "SQLDELTA" u32 version u32 chunk_size
+ *   snapshot: u32 SQLITE_DELTA_SNAP u32 nr_chunks u64 seq u64 db_size
+ *             nr_chunks * (u64 offset, chunk_size bytes)
+ *             u32 SQLITE_DELTA_DONE u32 nr_chunks
+ * A snapshot without its trailer (e.g. torn by a crash) is ignored.
+ * misc/scripts/sqlite_delta.py restores a database from the file and compacts
+ * it into a single snapshot.
+ */
+#define SQLITE_DELTA_VFS "memdelta"
+#define SQLITE_DELTA_CHUNK 4096
+#define SQLITE_DELTA_MAX_FILES 8
+#define SQLITE_DELTA_VERSION 1
+#define SQLITE_DELTA_SNAP 0x50414e53 // "SNAP"
+#define SQLITE_DELTA_DONE 0x454e4f44 // "DONE"
+
+struct sqlite_delta_data {
+	char name[64];
+	int used;
+	int refs;
+	int track; // main database: record written chunks
+	unsigned char *buf;
+	sqlite3_int64 size;
+	sqlite3_int64 capacity;
+	unsigned char *dirty; // one bit per chunk
+	sqlite3_int64 dirty_capacity; // in chunks
+	unsigned long long seq; // snapshots written
+};
+
+struct sqlite_delta_file {
+	sqlite3_file base;
+	struct sqlite_delta_data *data;
+	int delete_on_close;
+};
+
+static struct sqlite_delta_data sqlite_delta_files[SQLITE_DELTA_MAX_FILES];
+
+static struct sqlite_delta_data *sqlite_delta_lookup(const char *name)
+{
+	for (int i = 0; i < SQLITE_DELTA_MAX_FILES; i++) {
+		struct sqlite_delta_data *d = &sqlite_delta_files[i];
+
+		if (d->used && name && strcmp(d->name, name) == 0)
+			return d;
+	}
+	return NULL;
+}
+
+static void sqlite_delta_free(struct sqlite_delta_data *d)
+{
+	free(d->buf);
+	free(d->dirty);
+	memset(d, 0, sizeof(*d));
+}
+
+static int sqlite_delta_mark(struct sqlite_delta_data *d, sqlite3_int64 first,
+			     sqlite3_int64 end)
+{
+	sqlite3_int64 last = (end - 1) / SQLITE_DELTA_CHUNK;
+
+	if (last >= d->dirty_capacity) {
+		sqlite3_int64 cap = d->dirty_capacity ? d->dirty_capacity : 64;
+		unsigned char *dirty;
+
+		while (cap <= last)
+			cap *= 2;
+		dirty = realloc(d->dirty, cap / 8);
+		if (!dirty)
+			return SQLITE_NOMEM;
+		memset(dirty + d->dirty_capacity / 8, 0,
+		       (cap - d->dirty_capacity) / 8);
+		d->dirty = dirty;
+		d->dirty_capacity = cap;
+	}
+	for (sqlite3_int64 c = first / SQLITE_DELTA_CHUNK; c <= last; c++)
+		d->dirty[c / 8] |= 1 << (c % 8);
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_close(sqlite3_file *file)
+{
+	struct sqlite_delta_file *f = (struct sqlite_delta_file *)file;
+
+	// the main database stays until it is deleted, like a file
+	if (--f->data->refs == 0 && f->delete_on_close)
+		sqlite_delta_free(f->data);
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_read(sqlite3_file *file, void *buf, int amt,
+			     sqlite3_int64 off)
+{
+	struct sqlite_delta_data *d = ((struct sqlite_delta_file *)file)->data;
+	sqlite3_int64 n = off < d->size ? d->size - off : 0;
+
+	if (n > amt)
+		n = amt;
+	memcpy(buf, d->buf + off, n);
+	if (n < amt) {
+		memset((char *)buf + n, 0, amt - n);
+		return SQLITE_IOERR_SHORT_READ;
+	}
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_write(sqlite3_file *file, const void *buf, int amt,
+			      sqlite3_int64 off)
+{
+	struct sqlite_delta_data *d = ((struct sqlite_delta_file *)file)->data;
+	sqlite3_int64 end = off + amt;
+
+	if (end > d->capacity) {
+		sqlite3_int64 cap = d->capacity ? d->capacity : 64 * 1024;
+		unsigned char *p;
+
+		while (cap < end)
+			cap *= 2;
+		p = realloc(d->buf, cap);
+		if (!p)
+			return SQLITE_IOERR_NOMEM;
+		d->buf = p;
+		d->capacity = cap;
+	}
+	if (off > d->size) {
+		memset(d->buf + d->size, 0, off - d->size);
+		// the gap may hide data of a larger, truncated database
+		if (d->track && sqlite_delta_mark(d, d->size, off) != SQLITE_OK)
+			return SQLITE_IOERR_NOMEM;
+	}
+	memcpy(d->buf + off, buf, amt);
+	if (end > d->size)
+		d->size = end;
+	if (d->track && amt > 0 && sqlite_delta_mark(d, off, end) != SQLITE_OK)
+		return SQLITE_IOERR_NOMEM;
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_truncate(sqlite3_file *file, sqlite3_int64 size)
+{
+	struct sqlite_delta_data *d = ((struct sqlite_delta_file *)file)->data;
+
+	// the new size is part of every snapshot
+	if (size < d->size)
+		d->size = size;
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_sync(sqlite3_file *file __unused, int flags __unused)
+{
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_file_size(sqlite3_file *file, sqlite3_int64 *size)
+{
+	*size = ((struct sqlite_delta_file *)file)->data->size;
+	return SQLITE_OK;
+}
+
+// one connection per file: locks always succeed
+static int sqlite_delta_lock(sqlite3_file *file __unused, int lock __unused)
+{
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_check_reserved_lock(sqlite3_file *file __unused,
+					    int *out)
+{
+	*out = 0;
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_file_control(sqlite3_file *file __unused,
+				     int op __unused, void *arg __unused)
+{
+	return SQLITE_NOTFOUND;
+}
+
+static int sqlite_delta_sector_size(sqlite3_file *file __unused)
+{
+	return SQLITE_DELTA_CHUNK;
+}
+
+static int sqlite_delta_device_characteristics(sqlite3_file *file __unused)
+{
+	return SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_SAFE_APPEND
+	       | SQLITE_IOCAP_SEQUENTIAL | SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+static const sqlite3_io_methods sqlite_delta_io = {
+	.iVersion = 1,
+	.xClose = sqlite_delta_close,
+	.xRead = sqlite_delta_read,
+	.xWrite = sqlite_delta_write,
+	.xTruncate = sqlite_delta_truncate,
+	.xSync = sqlite_delta_sync,
+	.xFileSize = sqlite_delta_file_size,
+	.xLock = sqlite_delta_lock,
+	.xUnlock = sqlite_delta_lock,
+	.xCheckReservedLock = sqlite_delta_check_reserved_lock,
+	.xFileControl = sqlite_delta_file_control,
+	.xSectorSize = sqlite_delta_sector_size,
+	.xDeviceCharacteristics = sqlite_delta_device_characteristics,
+};
+
+static int sqlite_delta_xopen(sqlite3_vfs *vfs __unused, const char *name,
+			      sqlite3_file *file, int flags, int *out_flags)
+{
+	struct sqlite_delta_file *f = (struct sqlite_delta_file *)file;
+	struct sqlite_delta_data *d = sqlite_delta_lookup(name);
+
+	f->base.pMethods = NULL;
+	if (!d) {
+		if (!(flags & SQLITE_OPEN_CREATE)
+		    || (name && strlen(name) >= sizeof(d->name)))
+			return SQLITE_CANTOPEN;
+		for (int i = 0; i < SQLITE_DELTA_MAX_FILES && !d; i++) {
+			if (!sqlite_delta_files[i].used)
+				d = &sqlite_delta_files[i];
+		}
+		if (!d)
+			return SQLITE_CANTOPEN;
+		d->used = 1;
+		d->track = (flags & SQLITE_OPEN_MAIN_DB) != 0;
+		// temporary files have no name
+		if (name)
+			strcpy(d->name, name);
+	}
+	d->refs++;
+	f->data = d;
+	f->delete_on_close = !name || (flags & SQLITE_OPEN_DELETEONCLOSE);
+	f->base.pMethods = &sqlite_delta_io;
+	if (out_flags)
+		*out_flags = flags;
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_xdelete(sqlite3_vfs *vfs __unused, const char *name,
+				int sync __unused)
+{
+	struct sqlite_delta_data *d = sqlite_delta_lookup(name);
+
+	if (d && d->refs == 0)
+		sqlite_delta_free(d);
+	else if (d)
+		d->size = 0;
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_xaccess(sqlite3_vfs *vfs __unused, const char *name,
+				int flags __unused, int *out)
+{
+	struct sqlite_delta_data *d = sqlite_delta_lookup(name);
+
+	*out = d && d->size > 0;
+	return SQLITE_OK;
+}
+
+static int sqlite_delta_xfull_pathname(sqlite3_vfs *vfs __unused,
+				       const char *name,
+				       int n, char *out)
+{
+	sqlite3_snprintf(n, out, "%s", name);
+	return SQLITE_OK;
+}
+
+// the rest is done by the default VFS
+static void *sqlite_delta_xdl_open(sqlite3_vfs *vfs, const char *name)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	return real->xDlOpen(real, name);
+}
+
+static void sqlite_delta_xdl_error(sqlite3_vfs *vfs, int n, char *out)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	real->xDlError(real, n, out);
+}
+
+static void (*sqlite_delta_xdl_sym(sqlite3_vfs *vfs, void *handle,
+				   const char *sym))(void)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	return real->xDlSym(real, handle, sym);
+}
+
+static void sqlite_delta_xdl_close(sqlite3_vfs *vfs, void *handle)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	real->xDlClose(real, handle);
+}
+
+static int sqlite_delta_xrandomness(sqlite3_vfs *vfs, int n, char *out)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	return real->xRandomness(real, n, out);
+}
+
+static int sqlite_delta_xsleep(sqlite3_vfs *vfs, int us)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	return real->xSleep(real, us);
+}
+
+static int sqlite_delta_xcurrent_time(sqlite3_vfs *vfs, double *out)
+{
+	sqlite3_vfs *real = vfs->pAppData;
+
+	return real->xCurrentTime(real, out);
+}
+
+static int sqlite_delta_xget_last_error(sqlite3_vfs *vfs __unused,
+					int n __unused, char *out __unused)
+{
+	return 0;
+}
+
+static sqlite3_vfs sqlite_delta_vfs = {
+	.iVersion = 1,
+	.szOsFile = sizeof(struct sqlite_delta_file),
+	.mxPathname = sizeof(((struct sqlite_delta_data *)0)->name),
+	.zName = SQLITE_DELTA_VFS,
+	.xOpen = sqlite_delta_xopen,
+	.xDelete = sqlite_delta_xdelete,
+	.xAccess = sqlite_delta_xaccess,
+	.xFullPathname = sqlite_delta_xfull_pathname,
+	.xDlOpen = sqlite_delta_xdl_open,
+	.xDlError = sqlite_delta_xdl_error,
+	.xDlSym = sqlite_delta_xdl_sym,
+	.xDlClose = sqlite_delta_xdl_close,
+	.xRandomness = sqlite_delta_xrandomness,
+	.xSleep = sqlite_delta_xsleep,
+	.xCurrentTime = sqlite_delta_xcurrent_time,
+	.xGetLastError = sqlite_delta_xget_last_error,
+};
+
+// Open (or create) the in-memory database name on the memdelta VFS. Like
+// ":memory:" it keeps the rollback journal in the pager instead of a file.
+static int sqlite_delta_open(const char *name, sqlite3 **db)
+{
+	int rc;
+
+	if (!sqlite_delta_vfs.pAppData) {
+		sqlite_delta_vfs.pAppData = sqlite3_vfs_find(NULL);
+		if (!sqlite_delta_vfs.pAppData)
+			return SQLITE_ERROR;
+		if (sqlite3_vfs_register(&sqlite_delta_vfs, 0) != SQLITE_OK)
+			return SQLITE_ERROR;
+	}
+	rc = sqlite3_open_v2(name, db,
+			     SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+			     SQLITE_DELTA_VFS);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(*db, "PRAGMA journal_mode=MEMORY", NULL, NULL,
+				  NULL);
+	return rc;
+}
+
+static int sqlite_delta_put32(FILE *fp, unsigned int v)
+{
+	unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+
+	return fwrite(b, sizeof(b), 1, fp) == 1 ? 0 : -1;
+}
+
+static int sqlite_delta_put64(FILE *fp, unsigned long long v)
+{
+	if (sqlite_delta_put32(fp, v) < 0)
+		return -1;
+	return sqlite_delta_put32(fp, v >> 32);
+}
+
+static int sqlite_delta_is_dirty(const unsigned char *dirty,
+				 sqlite3_int64 capacity, sqlite3_int64 c)
+{
+	return c < capacity && (dirty[c / 8] & (1 << (c % 8)));
+}
+
+// mark the chunks of a failed snapshot dirty again
+static void sqlite_delta_redirty(struct sqlite_delta_data *d,
+				 const unsigned char *dirty,
+				 sqlite3_int64 capacity)
+{
+	if (capacity > d->dirty_capacity)
+		capacity = d->dirty_capacity;
+	for (sqlite3_int64 i = 0; i < capacity / 8; i++)
+		d->dirty[i] |= dirty[i];
+}
+
+/*
+ * Append the chunks of db written since the last snapshot to the delta file
+ * path. Fails while db is in a transaction, the snapshot would not be
+ * consistent. Returns the number of chunks written or -1.
+ *
+ * The file writes can yield to a thread that changes the database, even
+ * shrinking or moving its buffer. So before any write the dirty bitmap is
+ * taken over and the dirty chunks and the size are copied into a private
+ * buffer: chunks written meanwhile go into the next snapshot.
+ */
+static long sqlite_delta_save(sqlite3 *db, const char *path)
+{
+	struct sqlite_delta_file *f = NULL;
+	struct sqlite_delta_data *d;
+	sqlite3_int64 chunks, nr = 0, capacity, size, i = 0;
+	unsigned char *dirty = NULL, *copy = NULL;
+	sqlite3_int64 *offs = NULL;
+	unsigned long long seq;
+	long start;
+	int full, err = 0;
+	FILE *fp;
+
+	if (!db) {
+		printf("db is not initialized\n");
+		return -1;
+	}
+	if (sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &f)
+		    != SQLITE_OK
+	    || !f || f->base.pMethods != &sqlite_delta_io) {
+		printf("delta: the database is not on the %s VFS\n",
+		       SQLITE_DELTA_VFS);
+		return -1;
+	}
+	d = f->data;
+
+	fp = fopen(path, "ab");
+	if (!fp) {
+		printf("delta: failed to open %s\n", path);
+		return -1;
+	}
+	if (fseek(fp, 0, SEEK_END) < 0 || (start = ftell(fp)) < 0) {
+		printf("delta: failed to seek %s\n", path);
+		fclose(fp);
+		return -1;
+	}
+	// a new file starts with the whole database
+	full = start == 0;
+
+	// nothing below yields until the snapshot is copied
+	if (!sqlite3_get_autocommit(db)) {
+		printf("delta: a transaction is open\n");
+		fclose(fp);
+		return -1;
+	}
+	size = d->size;
+	seq = d->seq;
+	capacity = d->dirty_capacity;
+	chunks = (size + SQLITE_DELTA_CHUNK - 1) / SQLITE_DELTA_CHUNK;
+	for (sqlite3_int64 c = 0; c < chunks; c++)
+		nr += full || sqlite_delta_is_dirty(d->dirty, capacity, c);
+	if (capacity)
+		dirty = malloc(capacity / 8);
+	copy = malloc(nr * SQLITE_DELTA_CHUNK);
+	offs = malloc(nr * sizeof(*offs));
+	if ((capacity && !dirty) || (nr && (!copy || !offs))) {
+		printf("delta: out of memory\n");
+		fclose(fp);
+		free(dirty);
+		free(copy);
+		free(offs);
+		return -1;
+	}
+	if (capacity) {
+		memcpy(dirty, d->dirty, capacity / 8);
+		memset(d->dirty, 0, capacity / 8);
+	}
+	for (sqlite3_int64 c = 0; c < chunks; c++) {
+		sqlite3_int64 off = c * SQLITE_DELTA_CHUNK;
+		sqlite3_int64 len = MIN(size - off, SQLITE_DELTA_CHUNK);
+		unsigned char *p = copy + i * SQLITE_DELTA_CHUNK;
+
+		if (!full && !sqlite_delta_is_dirty(dirty, capacity, c))
+			continue;
+		memcpy(p, d->buf + off, len);
+		memset(p + len, 0, SQLITE_DELTA_CHUNK - len);
+		offs[i++] = off;
+	}
+
+	if (full) {
+		err |= fwrite("SQLDELTA", 8, 1, fp) != 1;
+		err |= sqlite_delta_put32(fp, SQLITE_DELTA_VERSION);
+		err |= sqlite_delta_put32(fp, SQLITE_DELTA_CHUNK);
+	}
+	err |= sqlite_delta_put32(fp, SQLITE_DELTA_SNAP);
+	err |= sqlite_delta_put32(fp, nr);
+	err |= sqlite_delta_put64(fp, seq);
+	err |= sqlite_delta_put64(fp, size);
+	for (i = 0; i < nr && !err; i++) {
+		err |= sqlite_delta_put64(fp, offs[i]);
+		err |= fwrite(copy + i * SQLITE_DELTA_CHUNK, SQLITE_DELTA_CHUNK,
+			      1, fp) != 1;
+	}
+	err |= sqlite_delta_put32(fp, SQLITE_DELTA_DONE);
+	err |= sqlite_delta_put32(fp, nr);
+	err |= fflush(fp) != 0;
+	err |= fsync(fileno(fp)) != 0;
+	err |= fclose(fp) != 0;
+	free(copy);
+	free(offs);
+	if (err) {
+		// drop the partial snapshot, the chunks go into the next one
+		printf("delta: failed to write %s\n", path);
+		(void)truncate(path, start);
+		if (dirty)
+			sqlite_delta_redirty(d, dirty, capacity);
+		free(dirty);
+		return -1;
+	}
+
+	free(dirty);
+	printf("delta: snapshot %llu, %ld of %ld chunks (%ld KiB of %ld KiB)\n",
+	       seq, (long)nr, (long)chunks,
+	       (long)(nr * SQLITE_DELTA_CHUNK / 1024), (long)(size / 1024));
+	d->seq = seq + 1;
+	return nr;
+}
+
+#endif /* _SQLITE_DELTA_H */
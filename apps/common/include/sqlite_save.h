@@ -0,0 +1,205 @@
+#ifndef _SQLITE_SAVE_H
+#define _SQLITE_SAVE_H
+
+#include <stdio.h>
+#include <sqlite3.h>
+#include <uk/config.h>
+
+#ifdef CONFIG_LIBUKSCHED
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/wait.h>
+#endif
+
+/*
+ * Incremental backup of a database into a file.
+ *
+ * sqlite_save_start() copies SQLITE_SAVE_PAGES pages per
+ * sqlite3_backup_step() from a background thread and yields to the other
+ * threads between the steps, so that saving a large in-memory database does
+ * not stall the application or the shell. The file is a consistent
+ * snapshot of the state at the end: for a database file, changes made
+ * through the source connection are copied into the backup by SQLite, but
+ * for an in-memory source every commit restarts the backup from the first
+ * page. Restarts are counted and reported, a source that commits more often
+ * than the backup takes may never finish.
+ *
+ * A step can yield (file writes on 9p do), so the application's SQLite
+ * calls on the source connection can run in the middle of one: the
+ * background thread is only used if SQLite serializes the calls on a
+ * connection (sqlite3_threadsafe() == 1, the default threading mode).
+ *
+ * Otherwise, and without a scheduler, the same loop runs synchronously.
+ */
+#ifndef SQLITE_SAVE_PAGES
+#define SQLITE_SAVE_PAGES 64
+#endif
+
+struct sqlite_save {
+	int running;
+	int rc; // result of the last save
+	sqlite3 *dst;
+	sqlite3_backup *backup;
+	const char *path;
+	int remaining;
+	int pagecount;
+	unsigned long steps;
+	unsigned long restarts; // by commits to an in-memory source
+	int reported; // last reported progress in 10% steps
+#ifdef CONFIG_LIBUKSCHED
+	struct uk_waitq done;
+#endif
+};
+
+static struct sqlite_save sqlite_save_state;
+
+static void sqlite_save_finish(struct sqlite_save *s)
+{
+	(void)sqlite3_backup_finish(s->backup);
+	s->rc = sqlite3_errcode(s->dst);
+	(void)sqlite3_close(s->dst);
+	if (s->rc)
+		printf("SQLite3 save error: %d\n", s->rc);
+	else
+		printf("save: %s done, %d pages in %lu steps, %lu restarts\n",
+		       s->path, s->pagecount, s->steps, s->restarts);
+	s->running = 0;
+#ifdef CONFIG_LIBUKSCHED
+	uk_waitq_wake_up(&s->done);
+#endif
+}
+
+static void sqlite_save_loop(struct sqlite_save *s, int yield)
+{
+	int rc;
+	int copied = 0;
+
+	do {
+		rc = sqlite3_backup_step(s->backup, SQLITE_SAVE_PAGES);
+		s->steps++;
+		s->remaining = sqlite3_backup_remaining(s->backup);
+		s->pagecount = sqlite3_backup_pagecount(s->backup);
+		// the backup went back to the first page
+		if (s->pagecount - s->remaining < copied) {
+			s->restarts++;
+			s->reported = 0;
+			printf("save: restarted by a change of the source "
+			       "(%lu restarts)\n", s->restarts);
+		}
+		copied = s->pagecount - s->remaining;
+		if (s->pagecount > 0) {
+			int done = (s->pagecount - s->remaining) * 10
+				   / s->pagecount;
+			if (done > s->reported && rc == SQLITE_OK) {
+				s->reported = done;
+				printf("save: %d%% (%d/%d pages)\n", done * 10,
+				       s->pagecount - s->remaining,
+				       s->pagecount);
+			}
+		}
+#ifdef CONFIG_LIBUKSCHED
+		if (yield) {
+			uk_sched_yield();
+			continue;
+		}
+#else
+		(void)yield;
+#endif
+		// the source is locked by another connection, retry later
+		if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+			sqlite3_sleep(1);
+	} while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+	sqlite_save_finish(s);
+}
+
+#ifdef CONFIG_LIBUKSCHED
+static void sqlite_save_thread(void *arg)
+{
+	sqlite_save_loop(arg, 1);
+}
+#endif
+
+/*
+ * Start saving src into the file path (a string literal or otherwise kept
+ * alive until the save is done). Returns 0 if the save was started (or done,
+ * without a scheduler) and -1 on error or if a save is still running.
+ */
+static int sqlite_save_start(sqlite3 *src, const char *path)
+{
+	struct sqlite_save *s = &sqlite_save_state;
+
+	if (!src) {
+		printf("db is not initialized\n");
+		return -1;
+	}
+	if (s->running) {
+		printf("save: already saving to %s (%d/%d pages)\n", s->path,
+		       s->pagecount - s->remaining, s->pagecount);
+		return -1;
+	}
+
+	if (sqlite3_open(path, &s->dst)) {
+		printf("Failed to open db\n");
+		(void)sqlite3_close(s->dst);
+		return -1;
+	}
+	s->backup = sqlite3_backup_init(s->dst, "main", src, "main");
+	if (!s->backup) {
+		printf("SQLite3 save error: %s\n", sqlite3_errmsg(s->dst));
+		(void)sqlite3_close(s->dst);
+		return -1;
+	}
+
+	s->running = 1;
+	s->rc = 0;
+	s->path = path;
+	s->remaining = 0;
+	s->pagecount = 0;
+	s->steps = 0;
+	s->restarts = 0;
+	s->reported = 0;
+
+#ifdef CONFIG_LIBUKSCHED
+	uk_waitq_init(&s->done);
+	if (sqlite3_threadsafe() != 1)
+		printf("save: SQLite does not serialize calls, "
+		       "saving synchronously\n");
+	else if (uk_thread_create("sqlite_save", sqlite_save_thread, s))
+		return 0;
+	else
+		printf("save: no thread, saving synchronously\n");
+#endif
+	sqlite_save_loop(s, 0);
+	return s->rc ? -1 : 0;
+}
+
+// Wait until a running save is done. Returns the result of the last save.
+static int sqlite_save_wait(void)
+{
+	struct sqlite_save *s = &sqlite_save_state;
+
+#ifdef CONFIG_LIBUKSCHED
+	uk_waitq_wait_event(&s->done, !s->running);
+#endif
+	return s->rc;
+}
+
+// Print the progress of the running save or the result of the last one.
+void sqlite_save_status(void)
+{
+	struct sqlite_save *s = &sqlite_save_state;
+
+	if (s->running)
+		printf("save: saving to %s, %d/%d pages in %lu steps, "
+		       "%lu restarts\n",
+		       s->path, s->pagecount - s->remaining, s->pagecount,
+		       s->steps, s->restarts);
+	else if (s->path)
+		printf("save: last save to %s %s (%d)\n", s->path,
+		       s->rc ? "failed" : "done", s->rc);
+	else
+		printf("save: nothing saved yet\n");
+}
+
+#endif /* _SQLITE_SAVE_H */
@@ -6,9 +6,64 @@
 int ushell_disable_write();
 int ushell_enable_write();
 int ushell_write_is_enabled();
+
+// Number of write windows enclosing the code, known at compile time: each
+// unikraft_write_window_begin() shadows it with the outer value + 1.
+enum { unikraft_write_depth = 0 };
+
+// Write window: opens the kernel domain once for a block of unikraft calls
+// instead of two WRPKRUs around each of them. Like pthread_cleanup_push/pop
+// the two macros have to be paired in the same block:
+//
+//	unikraft_write_window_begin();
+//	unikraft_call_wrapper(sleep, 1);
+//	unikraft_call_wrapper(ushell_puts, buf);
+//	unikraft_write_window_end();
+//
+// Within the window the wrappers below are plain calls. Nested windows are
+// elided at compile time, and the outermost one is closed on every way out
+// of the block (return, break, goto) by the cleanup attribute. A window
+// opened by the caller (write already enabled) is left open.
+// longjmp skips cleanups: call unikraft_write_window_reset() where it lands.
+static inline int unikraft_write_window_open(void)
+{
+	if (ushell_write_is_enabled())
+		return 0;
+	ushell_enable_write();
+	return 1;
+}
+
+static inline void unikraft_write_window_close(int *opened)
+{
+	if (*opened) {
+		*opened = 0;
+		ushell_disable_write();
+	}
+}
+
+#define unikraft_write_window_begin()                                          \
+	{                                                                      \
+		enum { unikraft_write_depth = unikraft_write_depth + 1 };      \
+		int __unikraft_write_opened                                    \
+		    __attribute__((cleanup(unikraft_write_window_close)))      \
+		    = unikraft_write_depth == 1 ? unikraft_write_window_open() \
+						: 0;                           \
+		(void)__unikraft_write_opened
+
+#define unikraft_write_window_end() }
+
+// restore the domain expected at this point after a longjmp
+#define unikraft_write_window_reset()                                          \
+	do {                                                                   \
+		if (unikraft_write_depth > 0)                                  \
+			ushell_enable_write();                                 \
+		else if (ushell_write_is_enabled())                            \
+			ushell_disable_write();                                \
+	} while (0)
+
 #define unikraft_call_wrapper(fname, ...)                                      \
 	do {                                                                   \
-		if (ushell_write_is_enabled()) {                               \
+		if (unikraft_write_depth > 0 || ushell_write_is_enabled()) {   \
 			fname(__VA_ARGS__);                                    \
 		} else {                                                       \
 			ushell_enable_write();                                 \
@@ -19,7 +74,7 @@ int ushell_write_is_enabled();
 
 #define unikraft_call_wrapper_ret(retval, fname, ...)                          \
 	do {                                                                   \
-		if (ushell_write_is_enabled()) {                               \
+		if (unikraft_write_depth > 0 || ushell_write_is_enabled()) {   \
 			retval = fname(__VA_ARGS__);                           \
 		} else {                                                       \
 			ushell_enable_write();                                 \
@@ -30,7 +85,7 @@ int ushell_write_is_enabled();
 
 #define unikraft_write_var(var, values)                                        \
 	do {                                                                   \
-		if (ushell_write_is_enabled()) {                               \
+		if (unikraft_write_depth > 0 || ushell_write_is_enabled()) {   \
 			var = values;                                          \
 		} else {                                                       \
 			ushell_enable_write();                                 \
@@ -56,6 +111,10 @@ do {								\
 			var = values;			\
 } while (0)
 
+#define unikraft_write_window_begin() {
+#define unikraft_write_window_end() }
+#define unikraft_write_window_reset() do {} while (0)
+
 #endif /* HAS_MPK */
 
 #endif /* UNICALL_WRAPPER_H */
@@ -0,0 +1,101 @@
+#include "unicall_wrapper.h"
+
+#include <stdint.h>
+
+extern void ushell_puts(char *);
+extern void set_count(int);
+#define __printf(fmt, args) __attribute__((format(printf, (fmt), (args))))
+extern int snprintf(char *str, long size, const char *fmt, ...) __printf(3, 4);
+
+// Cost of the MPK domain switch per unicall:
+// > run mpk_bench [iterations]
+// - wrapper: unikraft_call_wrapper() around every call (check + 2 WRPKRU)
+// - window:  the same calls in one unikraft_write_window_begin/end()
+// - switch:  ushell_enable_write() + ushell_disable_write() alone
+
+int atoi(char *str)
+{
+	int a = 0;
+	char *p = str;
+	while (*p != '\0' && *p >= '0' && *p <= '9') {
+		a *= 10;
+		a += (*p - '0');
+		p++;
+	}
+	return a;
+}
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)lo | (uint64_t)hi << 32);
+}
+
+__attribute__((noinline)) static uint64_t bench_wrapper(int n)
+{
+	uint64_t start = rdtsc();
+	for (int i = 0; i < n; i++) {
+		unikraft_call_wrapper(set_count, i);
+	}
+	return rdtsc() - start;
+}
+
+__attribute__((noinline)) static uint64_t bench_window(int n)
+{
+	uint64_t start = rdtsc();
+	unikraft_write_window_begin();
+	for (int i = 0; i < n; i++) {
+		unikraft_call_wrapper(set_count, i);
+	}
+	unikraft_write_window_end();
+	return rdtsc() - start;
+}
+
+__attribute__((noinline)) static uint64_t bench_switch(int n)
+{
+	uint64_t start = rdtsc();
+	for (int i = 0; i < n; i++) {
+#ifdef HAS_MPK
+		ushell_enable_write();
+		ushell_disable_write();
+#endif
+	}
+	return rdtsc() - start;
+}
+
+char msg[] = "%-8s %d calls: %lu cycles, %lu cycles/call\n";
+char name_wrapper[] = "wrapper";
+char name_window[] = "window";
+char name_switch[] = "switch";
+
+__attribute__((section(".text")))
+int main(int argc, char *argv[])
+{
+	int n = 100000;
+	char buf[128];
+	uint64_t wrapper, window, pkru;
+
+	if (argc >= 2) {
+		n = atoi(argv[1]);
+	}
+	if (n <= 0) {
+		return 1;
+	}
+
+	wrapper = bench_wrapper(n);
+	window = bench_window(n);
+	pkru = bench_switch(n);
+
+	unikraft_write_window_begin();
+	snprintf(buf, sizeof(buf), msg, name_wrapper, n, wrapper, wrapper / n);
+	ushell_puts(buf);
+	snprintf(buf, sizeof(buf), msg, name_window, n, window, window / n);
+	ushell_puts(buf);
+	snprintf(buf, sizeof(buf), msg, name_switch, n, pkru, pkru / n);
+	ushell_puts(buf);
+	unikraft_write_window_end();
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include "unicall_wrapper.h"
+
+#include <stdint.h>
+
+extern void ushell_puts(char *);
+extern unsigned long ushell_out_puts(const char *);
+extern void ushell_out_flush(void);
+#define __printf(fmt, args) __attribute__((format(printf, (fmt), (args))))
+extern int snprintf(char *str, long size, const char *fmt, ...) __printf(3, 4);
+
+// Time spent printing lines with ushell_puts (synchronous console write)
+// and with the buffered ushell_out_puts (+ the final flush):
+// > run out_bench [lines]
+
+int atoi(char *str)
+{
+	int a = 0;
+	char *p = str;
+	while (*p != '\0' && *p >= '0' && *p <= '9') {
+		a *= 10;
+		a += (*p - '0');
+		p++;
+	}
+	return a;
+}
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)lo | (uint64_t)hi << 32);
+}
+
+char line[] = "%d: the quick brown fox jumps over the lazy dog\n";
+char result[] = "%d lines: ushell_puts %lu cycles/line, ushell_out_puts %lu "
+		"cycles/line (%lu before the flush)\n";
+
+__attribute__((section(".text")))
+int main(int argc, char *argv[])
+{
+	int n = 1000;
+	char buf[128];
+	uint64_t start, sync, buffered, flushed;
+
+	if (argc >= 2) {
+		n = atoi(argv[1]);
+	}
+	if (n <= 0) {
+		return 1;
+	}
+
+	unikraft_write_window_begin();
+	start = rdtsc();
+	for (int i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), line, i);
+		ushell_puts(buf);
+	}
+	sync = rdtsc() - start;
+
+	start = rdtsc();
+	for (int i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), line, i);
+		ushell_out_puts(buf);
+	}
+	buffered = rdtsc() - start;
+	ushell_out_flush();
+	flushed = rdtsc() - start;
+
+	snprintf(buf, sizeof(buf), result, n, sync / n, flushed / n,
+		 buffered / n);
+	ushell_puts(buf);
+	unikraft_write_window_end();
+
+	return 0;
+}
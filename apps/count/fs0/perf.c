@@ -1,6 +1,8 @@
 #include "unicall_wrapper.h"
 
 extern void ushell_puts(char *);
+extern unsigned long ushell_out_puts(const char *);
+extern void ushell_out_flush(void);
 extern unsigned int sleep(unsigned);
 #define __printf(fmt, args) __attribute__((format(printf, (fmt), (args))))
 extern int snprintf(char *str, long size, const char *fmt, ...) __printf(3, 4);
@@ -67,11 +69,31 @@ static inline void wrmsr(unsigned int msr, __u32 lo, __u32 hi)
 		     : "c"(msr), "a"(lo), "d"(hi));
 }
 
+// callers open the MPK write window once around all MSR writes, see
+// setup_counters()
 static inline void wrmsrl(unsigned int msr, __u64 val)
 {
-	ushell_enable_write();
 	wrmsr(msr, (__u32)(val & 0xffffffffULL), (__u32)(val >> 32));
-	ushell_disable_write();
+}
+
+static inline __u64 rdpmc(__u32 ecx)
+{
+	__u32 lo, hi;
+
+	asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(ecx));
+	return ((__u64)lo | (__u64)hi << 32);
+}
+
+#define CR4_PCE (1 << 8)
+
+// allow rdpmc outside of ring 0 as well
+static inline void enable_rdpmc()
+{
+	unsigned long cr4;
+
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	if (!(cr4 & CR4_PCE))
+		asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PCE));
 }
 
 // CPUID.0AH: EAX[7:0] > 0
@@ -135,11 +157,22 @@ void enable_llc_misses(int sel)
 	set_eventsel(umask, event, sel);
 }
 
+// rdpmc does not serialize and, unlike rdmsr, doesn't exit to the
+// hypervisor, so it can be used in tight loops
 unsigned long rdpmc_ctr(int sel)
 {
-	unsigned msr;
-	msr = IA32_PERF_PERFCTR0 + sel;
-	return rdmsrl(msr);
+	return rdpmc(sel);
+}
+
+// all MSR writes happen here, within a single write window
+void setup_counters()
+{
+	unikraft_write_window_begin();
+	enable_rdpmc();
+	enable_counter();
+	enable_instruction_retired(0);
+	enable_llc_misses(1);
+	unikraft_write_window_end();
 }
 
 char msg1[] = "pmc not available\n";
@@ -160,17 +193,21 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
-	enable_counter();
-	enable_instruction_retired(0);
-	enable_llc_misses(1);
+	setup_counters();
 
 	for (i = 0; i < n; i++) {
+		// the kernel domain stays closed while we sleep
 		unikraft_call_wrapper(sleep, 1);
 		unsigned long c0 = rdpmc_ctr(0);
 		unsigned long c1 = rdpmc_ctr(1);
+		// one window for the two calls instead of one per call
+		unikraft_write_window_begin();
 		unikraft_call_wrapper(snprintf, buf, sizeof(buf), msg2, i, c0, c1);
-		ushell_puts(buf);
+		// buffered, printed by the ushell_out thread while we sleep
+		ushell_out_puts(buf);
+		unikraft_write_window_end();
 	}
+	unikraft_call_wrapper(ushell_out_flush);
 
 	return 0;
 }
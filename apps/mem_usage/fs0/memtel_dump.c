@@ -0,0 +1,28 @@
+#include "unicall_wrapper.h"
+
+extern void ushell_puts(char *);
+extern void memtel_dump(unsigned long since, void (*puts_fn)(char *line));
+
+unsigned long atoi(char *str)
+{
+	unsigned long a = 0;
+	char *p = str;
+	while (*p != '\0' && *p >= '0' && *p <= '9') {
+		a *= 10;
+		a += (*p - '0');
+		p++;
+	}
+	return a;
+}
+
+// memtel_dump [since]: print the allocator samples from seq since on
+__attribute__((section(".text")))
+int main(int argc, char *argv[])
+{
+	unsigned long since = 0;
+	if (argc >= 2) {
+		since = atoi(argv[1]);
+	}
+	unikraft_call_wrapper(memtel_dump, since, ushell_puts);
+	return 0;
+}
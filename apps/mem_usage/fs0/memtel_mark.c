@@ -0,0 +1,28 @@
+#include "unicall_wrapper.h"
+
+extern void memtel_mark(const char *event);
+extern int memtel_start(unsigned int period_ms);
+
+unsigned int atoi(char *str)
+{
+	unsigned int a = 0;
+	char *p = str;
+	while (*p != '\0' && *p >= '0' && *p <= '9') {
+		a *= 10;
+		a += (*p - '0');
+		p++;
+	}
+	return a;
+}
+
+// memtel_mark <event> [period_ms]: record a sample labelled event, e.g.
+// before and after attaching a probe, and optionally change the rate
+__attribute__((section(".text")))
+int main(int argc, char *argv[])
+{
+	if (argc >= 3) {
+		unikraft_call_wrapper(memtel_start, atoi(argv[2]));
+	}
+	unikraft_call_wrapper(memtel_mark, argc >= 2 ? argv[1] : "mark");
+	return 0;
+}
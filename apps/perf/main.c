@@ -1,129 +1,61 @@
 #include <stdio.h>
 #include <unistd.h>
 
-// cf. Intel SDM CHAPTER 19 PERFORMANCE MONITORING
+#include <pmu.h>
 
-#define IA32_PERF_EVENTSEL0 0x186
-#define IA32_PERF_EVENTSEL1 0x187
+#include "profile.h"
 
-#define IA32_PERF_PERFCTR0 0xc1
-#define IA32_PERF_PERFCTR1 0xc2
-
-#define IA32_PERF_GLOBAL_STATUS 0x38e
-#define IA32_PERF_GLOBAL_CTRL 0x38f
-
-#define IA32_FIXED_CTR_CTRL 0x38d
-#define IA32_FIXED_CTR0 0x309 // Instructions Retired
-#define IA32_FIXED_CTR1 0x30a // Unhalted CPU Cycles
-#define IA32_FIXED_CTR2 0x30b // Reference CPU Cycles
-
-static inline void cpuid(__u32 fn, __u32 subfn, __u32 *eax, __u32 *ebx,
-			 __u32 *ecx, __u32 *edx)
-{
-	asm volatile("cpuid"
-		     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
-		     : "a"(fn), "c"(subfn));
-}
-
-static inline void rdmsr(unsigned int msr, __u32 *lo, __u32 *hi)
-{
-	asm volatile("rdmsr" : "=a"(*lo), "=d"(*hi) : "c"(msr));
-}
-
-static inline __u64 rdmsrl(unsigned int msr)
+unsigned long get_counter_state()
 {
-	__u32 lo, hi;
-
-	rdmsr(msr, &lo, &hi);
-	return ((__u64)lo | (__u64)hi << 32);
+	return rdmsrl(IA32_PERF_GLOBAL_CTRL);
 }
 
-static inline void wrmsr(unsigned int msr, __u32 lo, __u32 hi)
+// workload for the profiler demo, fib() should get ~3/4 of the samples
+static __attribute__((noinline)) unsigned long fib(int n)
 {
-	asm volatile("wrmsr"
-		     : /* no outputs */
-		     : "c"(msr), "a"(lo), "d"(hi));
+	return n < 2 ? n : fib(n - 1) + fib(n - 2);
 }
 
-static inline void wrmsrl(unsigned int msr, __u64 val)
+static __attribute__((noinline)) unsigned long loop(unsigned long n)
 {
-	wrmsr(msr, (__u32)(val & 0xffffffffULL), (__u32)(val >> 32));
-}
+	volatile unsigned long sum = 0;
 
-// CPUID.0AH: EAX[7:0] > 0
-int check_pmc()
-{
-	__u32 eax, ebx, ecx, edx;
-	cpuid(0x0A, 0, &eax, &ebx, &ecx, &edx);
-	int version = eax & 0xff;
-#if 0
-	printf("CPUID.0AH: EAX=%#08x\n", eax);
-	printf("version = %d\n", version);
-#endif
-	return version > 0;
+	for (unsigned long i = 0; i < n; i++)
+		sum += i;
+	return sum;
 }
 
-unsigned long get_counter_state()
+static void profile_workload(void)
 {
-	unsigned msr;
-	msr = IA32_PERF_GLOBAL_CTRL;
-
-	return rdmsrl(msr);
-}
+	unsigned long sum = 0;
 
-void enable_counter()
-{
-	__u64 val;
-	unsigned msr;
-	__u32 eax, ebx, ecx, edx;
-	int num_counters, num_fixed_counters;
-
-	cpuid(0x0A, 0, &eax, &ebx, &ecx, &edx);
-	num_counters = (eax >> 8) & 0xff;
-	num_fixed_counters = edx & 0xf;
-#if 1
-	printf("num of counters = %d\n", num_counters);
-	printf("num of fixed counters = %d\n", num_fixed_counters);
-#endif
-
-	// enable all counters
-	val = (((__u64)((1 << num_fixed_counters) - 1)) << 32)
-	      | ((1 << num_counters) - 1);
-	msr = IA32_PERF_GLOBAL_CTRL;
-	wrmsrl(msr, val);
+	for (int i = 0; i < 20; i++) {
+		sum += fib(27);
+		sum += loop(1000000);
+	}
+	printf("workload result: %lu\n", sum);
 }
 
-void set_eventsel(__u8 umask, __u8 event, int sel)
-{
-	__u64 val;
-	unsigned msr;
-
-	// enable = 1 (0x4)
-	// os = 1, user=1 (0x3)
-	val = 0x00430000 | ((__u64)umask << 8) | event;
-	msr = IA32_PERF_EVENTSEL0 + sel;
-	wrmsrl(msr, val);
-}
+#define PERF_STAT_SLICE_MS 10
 
-void enable_instruction_retired(int sel)
+// Count events (comma separated names, see pmu_event_list()) for the given
+// number of seconds, rotating multiplexed events every PERF_STAT_SLICE_MS.
+// Exported so that ushell programs can run it.
+int perf_stat(const char *events, unsigned int seconds)
 {
-	__u8 umask = 0x00;
-	__u8 event = 0xc0;
-	set_eventsel(umask, event, sel);
-}
+	struct pmu_group group;
 
-void enable_llc_misses(int sel)
-{
-	__u8 umask = 0x41;
-	__u8 event = 0x2e;
-	set_eventsel(umask, event, sel);
-}
+	if (pmu_group_init(&group, events) < 0)
+		return -1;
 
-unsigned long rdpmc_ctr(int sel)
-{
-	unsigned msr;
-	msr = IA32_PERF_PERFCTR0 + sel;
-	return rdmsrl(msr);
+	pmu_group_start(&group);
+	for (unsigned int i = 0; i < seconds * 1000 / PERF_STAT_SLICE_MS; i++) {
+		usleep(PERF_STAT_SLICE_MS * 1000);
+		pmu_group_rotate(&group);
+	}
+	pmu_group_stop(&group);
+	pmu_group_print(&group);
+	return 0;
 }
 
 int main()
@@ -131,26 +63,53 @@ int main()
 	int i = 0;
 	unsigned long before, after;
 
-	if (!check_pmc()) {
+	before = get_counter_state();
+	if (pmu_init() < 0) {
 		printf("pmc not available\n");
 		return 0;
 	}
+	printf("num of counters = %d\n", pmu_num_counters());
 
-	before = get_counter_state();
-	printf("enable counter\n");
-	enable_counter();
+	pmu_enable_instruction_retired(0);
+	pmu_enable_llc_misses(1);
 	after = get_counter_state();
 	printf("counter state: %#lx => %#lx\n", before, after);
 
-	enable_instruction_retired(0);
-	enable_llc_misses(1);
-
 	for (i = 0; i < 3; i++) {
 		sleep(1);
-		unsigned long c0 = rdpmc_ctr(0);
-		unsigned long c1 = rdpmc_ctr(1);
+		unsigned long c0 = pmu_read(0);
+		unsigned long c1 = pmu_read(1);
 		printf("%ld instructions, %ld cache-misses\n", c0, c1);
 	}
+	pmu_counter_disable(0);
+	pmu_counter_disable(1);
+
+	// more general events than counters, multiplexed while the workload runs
+	struct pmu_group group;
+	pmu_event_list();
+	if (pmu_group_init(&group,
+			   "instructions,cycles,ref-cycles,llc-references,"
+			   "llc-misses,branch-instructions,branch-misses,"
+			   "uops-issued,uops-retired-slots,"
+			   "idq-uops-not-delivered,recovery-cycles")
+	    == 0) {
+		pmu_group_start(&group);
+		for (i = 0; i < 20; i++) {
+			fib(25);
+			loop(100000);
+			pmu_group_rotate(&group);
+		}
+		pmu_group_stop(&group);
+		pmu_group_print(&group);
+	}
+
+	// unhalted core cycles, one sample every 1M cycles
+	if (perf_profile_start(0x3c, 0x00, 1000000) == 0) {
+		profile_workload();
+		perf_profile_stop();
+		perf_profile_report(0);
+		perf_profile_report(1);
+	}
 
 	return 0;
 }
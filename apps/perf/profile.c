@@ -0,0 +1,400 @@
+/*
+ * Sampling profiler: a general counter reserved from the pmu library is
+ * armed to overflow every `period` events and the resulting PMI records the interrupted rip and its frame pointer
+ * chain into a per-CPU buffer. perf_profile_report() resolves the
+ * samples against the tracer's symbol table.
+ *
+ * Built with the isr variant (no SSE) since it runs in interrupt context.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uk/arch/limits.h>
+#include <uk/essentials.h>
+#include <uk/plat/lcpu.h>
+#if CONFIG_LIBUBPF_TRACER
+#include <ubpf_tracer.h>
+#endif
+
+#include <pmu.h>
+
+#include "profile.h"
+
+// above the PIC IRQs, which are remapped to 32-47
+#define PROFILE_VECTOR 0xf0
+
+#define IA32_APIC_BASE 0x1b
+#define APIC_BASE_EXTD (1 << 10)
+#define APIC_BASE_EN (1 << 11)
+
+#define X2APIC_EOI 0x80b
+#define X2APIC_SVR 0x80f
+#define X2APIC_LVT_PMI 0x834
+#define X2APIC_LVT_LINT0 0x835
+#define X2APIC_LVT_LINT1 0x836
+
+#define APIC_SVR_ENABLE (1 << 8)
+#define APIC_LVT_MASKED (1 << 16)
+#define APIC_DM_NMI 0x400
+#define APIC_DM_EXTINT 0x700
+
+#define PROFILE_MAX_SAMPLES 4096
+#define PROFILE_MAX_DEPTH 8 // frames per sample, including the rip
+
+#ifdef CONFIG_UKPLAT_LCPU_MAXCOUNT
+#define PROFILE_MAX_CPUS CONFIG_UKPLAT_LCPU_MAXCOUNT
+#else
+#define PROFILE_MAX_CPUS 1
+#endif
+
+struct profile_sample {
+	__u64 ips[PROFILE_MAX_DEPTH]; // innermost first, 0 terminated
+};
+
+struct profile_cpu {
+	struct profile_sample samples[PROFILE_MAX_SAMPLES];
+	__u64 nr_samples;
+	__u64 nr_dropped;
+};
+
+struct idt_gate {
+	__u16 offset_lo;
+	__u16 selector;
+	__u8 ist;
+	__u8 type_attr;
+	__u16 offset_mid;
+	__u32 offset_hi;
+	__u32 reserved;
+} __packed;
+
+struct idt_ptr {
+	__u16 limit;
+	__u64 base;
+} __packed;
+
+static struct profile_cpu profile_cpus[PROFILE_MAX_CPUS];
+static __u32 profile_period;
+static int profile_counter = -1; // from pmu_counter_reserve()
+
+extern void perf_profile_entry(void);
+
+static int profile_set_gate(void (*entry)(void))
+{
+	struct idt_ptr idtr;
+	__u16 cs;
+
+	asm volatile("sidt %0" : "=m"(idtr));
+	asm volatile("mov %%cs, %0" : "=r"(cs));
+	if (idtr.limit < (PROFILE_VECTOR + 1) * sizeof(struct idt_gate) - 1)
+		return -1;
+
+	struct idt_gate *gate = (struct idt_gate *)idtr.base + PROFILE_VECTOR;
+	__u64 addr = (__u64)entry;
+
+	gate->offset_lo = addr & 0xffff;
+	gate->selector = cs;
+	gate->ist = 0;
+	gate->type_attr = 0x8e; // present, DPL 0, interrupt gate
+	gate->offset_mid = (addr >> 16) & 0xffff;
+	gate->offset_hi = addr >> 32;
+	gate->reserved = 0;
+	return 0;
+}
+
+// Switch the local APIC to x2APIC mode so it can be driven through MSRs.
+// Once it is software enabled, PIC interrupts keep coming in through
+// LINT0 (virtual wire mode).
+static int profile_enable_apic(void)
+{
+	__u32 eax, ebx, ecx, edx;
+	__u64 base;
+
+	cpuid(0x01, 0, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1 << 21)))
+		return -1;
+
+	base = rdmsrl(IA32_APIC_BASE);
+	if (!(base & APIC_BASE_EXTD)) {
+		// disabled -> x2APIC is not a valid transition
+		base |= APIC_BASE_EN;
+		wrmsrl(IA32_APIC_BASE, base);
+		wrmsrl(IA32_APIC_BASE, base | APIC_BASE_EXTD);
+	}
+
+	if (!(rdmsrl(X2APIC_SVR) & APIC_SVR_ENABLE)) {
+		wrmsrl(X2APIC_LVT_LINT0, APIC_DM_EXTINT);
+		wrmsrl(X2APIC_LVT_LINT1, APIC_DM_NMI);
+		wrmsrl(X2APIC_SVR, APIC_SVR_ENABLE | 0xff);
+	}
+	return 0;
+}
+
+static void profile_record(struct profile_sample *sample, const __u64 *frame,
+			   __u64 rbp)
+{
+	__u64 rsp = frame[3];
+	int depth = 0;
+
+	sample->ips[depth++] = frame[0];
+
+	// follow frame pointers as long as they stay on the interrupted stack
+	while (depth < PROFILE_MAX_DEPTH && !(rbp & 7) && rbp >= rsp
+	       && rbp - rsp < __STACK_SIZE) {
+		const __u64 *fp = (const __u64 *)rbp;
+
+		sample->ips[depth++] = fp[1];
+		if (fp[0] <= rbp)
+			break;
+		rbp = fp[0];
+	}
+
+	if (depth < PROFILE_MAX_DEPTH)
+		sample->ips[depth] = 0;
+}
+
+// called from perf_profile_entry (profile_entry.S)
+void perf_profile_interrupt(const __u64 *frame, __u64 rbp)
+{
+	struct profile_cpu *cpu =
+	    &profile_cpus[ukplat_lcpu_id() % PROFILE_MAX_CPUS];
+
+	__u64 bit = profile_counter >= 0 ? 1ULL << profile_counter : 0;
+
+	if (rdmsrl(IA32_PERF_GLOBAL_STATUS) & bit) {
+		if (cpu->nr_samples < PROFILE_MAX_SAMPLES)
+			profile_record(&cpu->samples[cpu->nr_samples++], frame,
+				       rbp);
+		else
+			cpu->nr_dropped++;
+
+		// PERFCTR writes take 32 bits and sign extend them
+		wrmsrl(IA32_PERF_PERFCTR0 + profile_counter,
+		       -(__s64)profile_period);
+		wrmsrl(IA32_PERF_GLOBAL_OVF_CTRL, bit);
+	}
+
+	// delivering the PMI masks the LVT entry
+	wrmsrl(X2APIC_LVT_PMI, PROFILE_VECTOR);
+	wrmsrl(X2APIC_EOI, 0);
+}
+
+int perf_profile_start(__u8 event, __u8 umask, __u32 period)
+{
+	if (pmu_init() < 0) {
+		printf("pmc not available\n");
+		return -1;
+	}
+	if (period == 0 || period > 0x7fffffff) {
+		printf("invalid period %u\n", period);
+		return -1;
+	}
+	if (profile_counter >= 0) {
+		printf("profiler already running on counter %d\n",
+		       profile_counter);
+		return -1;
+	}
+	if (profile_set_gate(perf_profile_entry) < 0
+	    || profile_enable_apic() < 0) {
+		printf("x2apic not available\n");
+		return -1;
+	}
+	profile_counter = pmu_counter_reserve();
+	if (profile_counter < 0) {
+		printf("no free general counter\n");
+		return -1;
+	}
+
+	for (int i = 0; i < PROFILE_MAX_CPUS; i++) {
+		profile_cpus[i].nr_samples = 0;
+		profile_cpus[i].nr_dropped = 0;
+	}
+	profile_period = period;
+
+	wrmsrl(IA32_PERF_EVENTSEL0 + profile_counter, 0);
+	wrmsrl(IA32_PERF_PERFCTR0 + profile_counter, -(__s64)period);
+	wrmsrl(X2APIC_LVT_PMI, PROFILE_VECTOR);
+	wrmsrl(IA32_PERF_EVENTSEL0 + profile_counter,
+	       EVENTSEL_EN | EVENTSEL_INT | EVENTSEL_OS | EVENTSEL_USR
+		   | ((__u64)umask << 8) | event);
+	pmu_global_ctrl_update(1ULL << profile_counter, 0);
+	return 0;
+}
+
+void perf_profile_stop(void)
+{
+	if (profile_counter < 0)
+		return;
+
+	wrmsrl(IA32_PERF_EVENTSEL0 + profile_counter, 0);
+	pmu_global_ctrl_update(0, 1ULL << profile_counter);
+	wrmsrl(X2APIC_LVT_PMI, APIC_LVT_MASKED | PROFILE_VECTOR);
+	pmu_counter_release(profile_counter);
+	profile_counter = -1;
+}
+
+struct profile_symbol {
+	__u64 address;
+	const char *name;
+};
+
+static struct profile_symbol *profile_symbols;
+static __u32 profile_nr_symbols;
+
+#if CONFIG_LIBUBPF_TRACER
+static int profile_symbol_cmp(const void *a, const void *b)
+{
+	const struct profile_symbol *sa = a, *sb = b;
+
+	return (sa->address > sb->address) - (sa->address < sb->address);
+}
+#endif
+
+static void profile_load_symbols(void)
+{
+#if CONFIG_LIBUBPF_TRACER
+	struct UbpfTracer *tracer = get_tracer();
+
+	if (profile_symbols != NULL || tracer->symbols_cnt == 0)
+		return;
+
+	profile_symbols =
+	    malloc(tracer->symbols_cnt * sizeof(struct profile_symbol));
+	if (profile_symbols == NULL)
+		return;
+	for (__u32 i = 0; i < tracer->symbols_cnt; i++) {
+		profile_symbols[i].address = tracer->symbols[i].address;
+		profile_symbols[i].name = tracer->symbols[i].identifier;
+	}
+	qsort(profile_symbols, tracer->symbols_cnt,
+	      sizeof(struct profile_symbol), profile_symbol_cmp);
+	profile_nr_symbols = tracer->symbols_cnt;
+#endif
+}
+
+// index of the symbol containing ip, profile_nr_symbols if there is none
+static __u32 profile_symbol_index(__u64 ip)
+{
+	__u32 lo = 0, hi = profile_nr_symbols;
+
+	while (lo < hi) {
+		__u32 mid = lo + (hi - lo) / 2;
+
+		if (profile_symbols[mid].address <= ip)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo == 0 ? profile_nr_symbols : lo - 1;
+}
+
+static const char *profile_symbol_name(__u32 index)
+{
+	return index < profile_nr_symbols ? profile_symbols[index].name
+					  : "[unknown]";
+}
+
+struct profile_entry {
+	__u32 count;
+	__u32 frames[PROFILE_MAX_DEPTH]; // symbol indexes, innermost first
+};
+
+static int profile_entry_frames_cmp(const void *a, const void *b)
+{
+	return memcmp(((const struct profile_entry *)a)->frames,
+		      ((const struct profile_entry *)b)->frames,
+		      sizeof(((struct profile_entry *)0)->frames));
+}
+
+static int profile_entry_count_cmp(const void *a, const void *b)
+{
+	const struct profile_entry *ea = a, *eb = b;
+
+	return (ea->count < eb->count) - (ea->count > eb->count);
+}
+
+/*
+ * Print the samples taken since perf_profile_start(), either as a flat
+ * profile (samples per function, most frequent first) or as folded
+ * stacks ("outer;inner count") for flamegraph.pl. Call it after
+ * perf_profile_stop().
+ */
+void perf_profile_report(int folded)
+{
+	__u64 total = 0, dropped = 0;
+	__u32 nr_entries = 0;
+	struct profile_entry *entries;
+
+	for (int i = 0; i < PROFILE_MAX_CPUS; i++) {
+		total += profile_cpus[i].nr_samples;
+		dropped += profile_cpus[i].nr_dropped;
+	}
+	printf("%lu samples (%lu dropped), period %u\n", total, dropped,
+	       profile_period);
+	if (total == 0)
+		return;
+
+	profile_load_symbols();
+	entries = calloc(total, sizeof(struct profile_entry));
+	if (entries == NULL)
+		return;
+
+	for (int i = 0; i < PROFILE_MAX_CPUS; i++) {
+		for (__u64 j = 0; j < profile_cpus[i].nr_samples; j++) {
+			const struct profile_sample *sample =
+			    &profile_cpus[i].samples[j];
+			struct profile_entry *entry = &entries[nr_entries++];
+			int depth = folded ? PROFILE_MAX_DEPTH : 1;
+
+			entry->count = 1;
+			for (int k = 0; k < PROFILE_MAX_DEPTH; k++) {
+				entry->frames[k] =
+				    k < depth && sample->ips[k] != 0
+					? profile_symbol_index(sample->ips[k])
+					: UINT32_MAX;
+				if (entry->frames[k] == UINT32_MAX)
+					depth = 0;
+			}
+		}
+	}
+
+	// merge equal stacks
+	qsort(entries, nr_entries, sizeof(struct profile_entry),
+	      profile_entry_frames_cmp);
+	__u32 merged = 0;
+	for (__u32 i = 0; i < nr_entries; i++) {
+		if (merged > 0
+		    && profile_entry_frames_cmp(&entries[merged - 1], &entries[i])
+			   == 0)
+			entries[merged - 1].count++;
+		else
+			entries[merged++] = entries[i];
+	}
+	qsort(entries, merged, sizeof(struct profile_entry),
+	      profile_entry_count_cmp);
+
+	for (__u32 i = 0; i < merged; i++) {
+		const struct profile_entry *entry = &entries[i];
+
+		if (!folded) {
+			__u64 hundredths = entry->count * 10000 / total;
+
+			printf("%3lu.%02lu%% %8u %s\n", hundredths / 100,
+			       hundredths % 100, entry->count,
+			       profile_symbol_name(entry->frames[0]));
+			continue;
+		}
+
+		int depth = 0;
+		while (depth < PROFILE_MAX_DEPTH
+		       && entry->frames[depth] != UINT32_MAX)
+			depth++;
+		for (int k = depth - 1; k >= 0; k--)
+			printf("%s%s", profile_symbol_name(entry->frames[k]),
+			       k > 0 ? ";" : "");
+		printf(" %u\n", entry->count);
+	}
+
+	free(entries);
+}
@@ -0,0 +1,11 @@
+#ifndef PERF_PROFILE_H
+#define PERF_PROFILE_H
+
+#include <uk/arch/types.h>
+
+// sampling profiler on a reserved general counter, see profile.c
+int perf_profile_start(__u8 event, __u8 umask, __u32 period);
+void perf_profile_stop(void);
+void perf_profile_report(int folded);
+
+#endif /* PERF_PROFILE_H */
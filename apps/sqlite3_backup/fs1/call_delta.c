@@ -0,0 +1,9 @@
+#include "unicall_wrapper.h"
+
+extern void sqlite3_save_delta();
+
+__attribute__((section(".text"))) int main()
+{
+    unikraft_call_wrapper(sqlite3_save_delta);
+    return 0;
+}
@@ -1,9 +1,30 @@
 #include "unicall_wrapper.h"
 
 extern void sqlite3_generate_table();
+extern void sqlite3_bulk_load(int rows, int payload);
 
-__attribute__((section(".text"))) int main()
+int atoi(char *str)
 {
-    unikraft_call_wrapper(sqlite3_generate_table);
-    return 0;
+	int a = 0;
+	char *p = str;
+	while (*p != '\0' && *p >= '0' && *p <= '9') {
+		a *= 10;
+		a += (*p - '0');
+		p++;
+	}
+	return a;
+}
+
+// generate_table [rows [payload]]
+__attribute__((section(".text")))
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		unikraft_call_wrapper(sqlite3_generate_table);
+		return 0;
+	}
+	int rows = atoi(argv[1]);
+	int payload = argc >= 3 ? atoi(argv[2]) : 5;
+	unikraft_call_wrapper(sqlite3_bulk_load, rows, payload);
+	return 0;
 }
@@ -0,0 +1,9 @@
+#include "unicall_wrapper.h"
+
+extern void sqlite_save_status();
+
+__attribute__((section(".text"))) int main()
+{
+    unikraft_call_wrapper(sqlite_save_status);
+    return 0;
+}
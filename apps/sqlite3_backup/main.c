@@ -1,71 +1,120 @@
 #include <uk/config.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <sqlite3.h>
 
+#include "../common/include/sqlite_delta.h"
+#include "../common/include/sqlite_save.h"
+
 #ifdef CONFIG_LIBUKALLOC_IFSTATS
 #include "../common/include/memstat.h"
 #endif
 
-#define DB_INIT      "CREATE TABLE tab(INT, VARCHAR);"
-#define DB_QUERY     "INSERT INTO tab VALUES (null, 'value');"
+#define DB_INIT      "CREATE TABLE IF NOT EXISTS tab(INT, VARCHAR);"
+#define DB_INSERT    "INSERT INTO tab VALUES (null, ?);"
 #define OP_NUM      600000
+#define BULK_BATCH  10000
+#define BULK_PAYLOAD 5 // 'value'
 
 sqlite3 *db;
 
+// Save the database into "dump". The copy runs in the background, see
+// sqlite_save.h; sqlite_save_status shows the progress.
 void sqlite3_save()
 {
-	int rc;
-	sqlite3 *pFile;
-	sqlite3_backup *pBackup;
+	(void)sqlite_save_start(db, "dump");
+}
+
+// Append the pages changed since the last call to "dump.delta", see
+// sqlite_delta.h and misc/scripts/sqlite_delta.py. Needs APPAPP1_DELTA.
+void sqlite3_save_delta()
+{
+	(void)sqlite_delta_save(db, "dump.delta");
+}
+
+// Insert rows rows with a payload of payload bytes, BULK_BATCH rows per
+// transaction with one prepared statement.
+void sqlite3_bulk_load(int rows, int payload)
+{
+	int rc = SQLITE_OK;
+	char *errmsg;
+	char *value;
+	sqlite3_stmt *stmt;
+	struct timespec start, end;
+	double sec;
+	int i, committed = 0;
 
 	if (!db) {
 		printf("db is not initialized\n");
 		return;
 	}
+	if (rows < 0 || payload < 0) {
+		printf("Error: invalid row count or payload size\n");
+		return;
+	}
+	rc = sqlite3_exec(db, DB_INIT, NULL, NULL, &errmsg);
+	if (rc) {
+		printf("Error (init): %s\n", errmsg);
+		(void)sqlite3_free(errmsg);
+		return;
+	}
+
+	value = malloc(payload + 1);
+	if (!value) {
+		printf("Error: out of memory\n");
+		return;
+	}
+	for (i = 0; i < payload; i++)
+		value[i] = "value"[i % 5];
+	value[payload] = '\0';
 
-	rc = sqlite3_open("dump", &pFile);
+	rc = sqlite3_prepare_v2(db, DB_INSERT, -1, &stmt, NULL);
 	if (rc) {
-		printf("Failed to open db\n");
+		printf("Error (prepare): %s\n", sqlite3_errmsg(db));
+		free(value);
 		return;
 	}
 
-	pBackup = sqlite3_backup_init(pFile, "main", db, "main");
-	if (pBackup) {
-		(void)sqlite3_backup_step(pBackup, -1);
-		(void)sqlite3_backup_finish(pBackup);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < rows && rc == SQLITE_OK; i++) {
+		if (i % BULK_BATCH == 0)
+			rc = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+		if (rc == SQLITE_OK) {
+			sqlite3_bind_text(stmt, 1, value, payload,
+					  SQLITE_STATIC);
+			rc = sqlite3_step(stmt) == SQLITE_DONE
+				 ? SQLITE_OK : sqlite3_errcode(db);
+			sqlite3_reset(stmt);
+		}
+		if (rc == SQLITE_OK
+		    && (i % BULK_BATCH == BULK_BATCH - 1 || i == rows - 1)) {
+			rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+			if (rc == SQLITE_OK)
+				committed = i + 1;
+		}
 	}
-	rc = sqlite3_errcode(pFile);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
 	if (rc) {
-		printf("SQLite3 save error: %d\n", rc);
+		printf("Error (insert): %s\n", sqlite3_errmsg(db));
+		if (!sqlite3_get_autocommit(db))
+			(void)sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
 	}
+	sqlite3_finalize(stmt);
+	free(value);
 
-	(void)sqlite3_close(pFile);
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("generated %d rows of %d bytes in %.3f s (%.0f rows/s)\n",
+	       committed, payload, sec, sec > 0 ? committed / sec : 0);
 }
 
-void sqlite3_generate_table() {
-	int rc;
-	char *errmsg;
-	if (!db) {
-		printf("db is not initialized\n");
-		return;
-	}
-  rc = sqlite3_exec(db, DB_INIT, NULL, NULL, &errmsg);
-  if (rc) {
-    printf("Error (init): %s\n", errmsg);
-    (void)sqlite3_free(errmsg);
-    return;
-  }
-  for (int i = 0; i < OP_NUM; i++) {
-    rc = sqlite3_exec(db, DB_QUERY, NULL, NULL, &errmsg);
-    if (rc) {
-      printf("Error (insert): %s\n", errmsg);
-      (void)sqlite3_free(errmsg);
-      break;
-    }
-  }
+void sqlite3_generate_table()
+{
+	sqlite3_bulk_load(OP_NUM, BULK_PAYLOAD);
 }
 
 int main()
@@ -77,7 +126,12 @@ int main()
 
 	int rc;
 
+#ifdef CONFIG_APPAPP1_DELTA
+	// in memory, but with page tracking for sqlite3_save_delta
+	rc = sqlite_delta_open("main.db", &db);
+#else
 	rc = sqlite3_open(":memory:", &db);
+#endif
 	if (rc) {
 		printf("Failed to open db\n");
 		return 1;
@@ -92,8 +146,11 @@ int main()
 		if (!strncmp(buf, "exit\n", 5) || !strncmp(buf, "quit\n", 5)) {
 			break;
 		}
-    if (!strncmp(buf, "generate_table\n", 16)) {
-      sqlite3_generate_table();
+    if (!strncmp(buf, "generate_table", 14)
+        && (buf[14] == '\n' || buf[14] == ' ')) {
+      int rows = OP_NUM, payload = BULK_PAYLOAD;
+      sscanf(buf + 14, "%d %d", &rows, &payload);
+      sqlite3_bulk_load(rows, payload);
       continue;
     }
 		printf("%s", buf);
@@ -104,7 +161,10 @@ int main()
 		}
 	}
 
+	// finish a save started from the shell before the final one
+	(void)sqlite_save_wait();
 	sqlite3_save();
+	(void)sqlite_save_wait();
 
 	sqlite3_close(db);
 
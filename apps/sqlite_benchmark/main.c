@@ -1,11 +1,16 @@
 #include <uk/config.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <sqlite3.h>
 #include <time.h>
 
 #include <uk/plat/bootstrap.h>
 
+#include "../common/include/latency_hist.h"
+
+#include "../common/include/sqlite_save.h"
+
 #ifdef CONFIG_LIBUKALLOC_IFSTATS
 #include "../common/include/memstat.h"
 #endif
@@ -28,35 +33,11 @@
 
 sqlite3 *db;
 
-// this is the same workaround as in ../sqlite3_backup
+// Save the database into "dump". The copy runs in the background, see
+// sqlite_save.h; sqlite_save_status shows the progress.
 void sqlite3_save()
 {
-	int rc;
-	sqlite3 *pFile;
-	sqlite3_backup *pBackup;
-
-	if (!db) {
-		printf("db is not initialized\n");
-		return;
-	}
-
-	rc = sqlite3_open("dump", &pFile);
-	if (rc) {
-		printf("Failed to open db\n");
-		return;
-	}
-
-	pBackup = sqlite3_backup_init(pFile, "main", db, "main");
-	if (pBackup) {
-		(void)sqlite3_backup_step(pBackup, -1);
-		(void)sqlite3_backup_finish(pBackup);
-	}
-	rc = sqlite3_errcode(pFile);
-	if (rc) {
-		printf("SQLite3 save error: %d\n", rc);
-	}
-
-	(void)sqlite3_close(pFile);
+	(void)sqlite_save_start(db, "dump");
 }
 
 static int callback(
@@ -72,14 +53,285 @@ static int callback(
     return 0;
 }
 
+#ifndef WORKLOAD
+#define WORKLOAD    "exec"
+#endif
+
+#ifndef TXN_BATCH
+#define TXN_BATCH   1000
+#endif
+
+#ifndef SCAN_LEN
+#define SCAN_LEN    100
+#endif
+
+#define NSEC_PER_SEC 1000000000ULL
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// xorshift64, a fixed seed keeps the runs comparable
+static unsigned long long rand_state = 88172645463325252ULL;
+
+static unsigned long long rand_next(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+// state shared by the workloads of one run
+struct bench {
+    sqlite3_stmt *stmt;
+    sqlite3_stmt *commit;
+    sqlite3_int64 rows;    // ids 1..rows exist (for the read/update loads)
+};
+
+static int prepare(struct bench *b, const char *sql)
+{
+    int rc = sqlite3_prepare_v2(db, sql, -1, &b->stmt, NULL);
+    if (rc != SQLITE_OK)
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    return rc;
+}
+
+// step a statement until it is done and reset it for the next run
+static int step_all(sqlite3_stmt *stmt)
+{
+    int rc;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        ;
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return rc;
+    }
+    return SQLITE_OK;
+}
+
+static int exec_sql(const char *sql)
+{
+    char *zErrMsg = 0;
+    int rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", zErrMsg);
+        sqlite3_free(zErrMsg);
+    }
+    return rc;
+}
+
+static sqlite3_int64 random_id(struct bench *b)
+{
+    return rand_next() % b->rows + 1;
+}
+
+// the original benchmark: the INSERT is parsed again for every row
+static int exec_op(struct bench *b, int i)
+{
+    char *zErrMsg = 0;
+    int rc = sqlite3_exec(db, DB_QUERY, callback, 0, &zErrMsg);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", zErrMsg);
+        sqlite3_free(zErrMsg);
+    }
+    return rc;
+}
+
+static int insert_init(struct bench *b)
+{
+    return prepare(b, "INSERT INTO tab VALUES (null, ?)");
+}
+
+static int insert_op(struct bench *b, int i)
+{
+    sqlite3_bind_text(b->stmt, 1, "value", -1, SQLITE_STATIC);
+    return step_all(b->stmt);
+}
+
+// TXN_BATCH inserts per transaction, the COMMIT is charged to the last
+static int txn_init(struct bench *b)
+{
+    if (sqlite3_prepare_v2(db, "COMMIT", -1, &b->commit, NULL) != SQLITE_OK)
+        return SQLITE_ERROR;
+    return insert_init(b);
+}
+
+static int txn_op(struct bench *b, int i)
+{
+    int rc;
+
+    if (i % TXN_BATCH == 0 && (rc = exec_sql("BEGIN")) != SQLITE_OK)
+        return rc;
+    rc = insert_op(b, i);
+    if (rc == SQLITE_OK && (i % TXN_BATCH == TXN_BATCH - 1 || i == OP_NUM - 1))
+        rc = step_all(b->commit);
+    if (rc != SQLITE_OK)
+        sqlite3_exec(db, "ROLLBACK", NULL, 0, NULL);
+    return rc;
+}
+
+static int select_init(struct bench *b)
+{
+    return prepare(b, "SELECT text FROM tab WHERE id = ?");
+}
+
+static int select_op(struct bench *b, int i)
+{
+    sqlite3_bind_int64(b->stmt, 1, random_id(b));
+    return step_all(b->stmt);
+}
+
+static int scan_init(struct bench *b)
+{
+    return prepare(b, "SELECT id, text FROM tab WHERE id BETWEEN ? AND ?");
+}
+
+static int scan_op(struct bench *b, int i)
+{
+    sqlite3_int64 first = random_id(b);
+
+    sqlite3_bind_int64(b->stmt, 1, first);
+    sqlite3_bind_int64(b->stmt, 2, first + SCAN_LEN - 1);
+    return step_all(b->stmt);
+}
+
+static int update_init(struct bench *b)
+{
+    return prepare(b, "UPDATE tab SET text = ? WHERE id = ?");
+}
+
+static int update_op(struct bench *b, int i)
+{
+    sqlite3_bind_text(b->stmt, 1, "updated", -1, SQLITE_STATIC);
+    sqlite3_bind_int64(b->stmt, 2, random_id(b));
+    return step_all(b->stmt);
+}
+
+struct workload {
+    const char *name;
+    int (*init)(struct bench *b);  // optional
+    int (*op)(struct bench *b, int i);
+    int needs_rows;
+};
+
+static const struct workload workloads[] = {
+    {"exec", NULL, exec_op, 0},
+    {"prepared", insert_init, insert_op, 0},
+    {"txn", txn_init, txn_op, 0},
+    {"select", select_init, select_op, 1},
+    {"scan", scan_init, scan_op, 1},
+    {"update", update_init, update_op, 1},
+};
+
+#define NR_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static const struct workload *find_workload(const char *name)
+{
+    for (unsigned int i = 0; i < NR_WORKLOADS; i++) {
+        if (strcmp(workloads[i].name, name) == 0)
+            return &workloads[i];
+    }
+    return NULL;
+}
+
+static sqlite3_int64 max_id(void)
+{
+    sqlite3_stmt *stmt;
+    sqlite3_int64 id = 0;
+
+    if (sqlite3_prepare_v2(db, "SELECT max(id) FROM tab", -1, &stmt, NULL)
+        != SQLITE_OK)
+        return 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        id = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+// Run OP_NUM operations of a workload and print throughput and the latency
+// histogram. Returns the elapsed time in ns, or 0 on error.
+static unsigned long long run_workload(const struct workload *w,
+                                       struct latency_hist *lat)
+{
+    struct bench b = {0};
+    unsigned long long start, end;
+    int done = 0, rc = SQLITE_OK;
+
+    if (w->needs_rows) {
+        b.rows = max_id();
+        if (b.rows == 0) {
+            fprintf(stderr, "%s: the table is empty, run an insert workload"
+                    " first\n", w->name);
+            return 0;
+        }
+    }
+    if (w->init != NULL && w->init(&b) != SQLITE_OK)
+        goto out;
+
+    latency_hist_reset(lat);
+    start = now_ns();
+    for (; done < OP_NUM; done++) {
+        unsigned long long t = now_ns();
+
+        rc = w->op(&b, done);
+        if (rc != SQLITE_OK)
+            break;
+        latency_hist_record(lat, now_ns() - t);
+    }
+    end = now_ns();
+
+    if (done > 0) {
+        unsigned long long elapsed = end - start;
+
+        printf("%-8s %6d ops %10.0f ops/s p50 %8.2f us p99 %8.2f us\n",
+               w->name, done, done * (double)NSEC_PER_SEC / elapsed,
+               latency_hist_percentile(lat, 500) / 1000.0,
+               latency_hist_percentile(lat, 990) / 1000.0);
+        latency_hist_print(lat, w->name);
+    }
+
+out:
+    sqlite3_finalize(b.stmt);
+    sqlite3_finalize(b.commit);
+    return rc == SQLITE_OK && done > 0 ? end - start : 0;
+}
+
+// Usage: sqlite_benchmark [workload...] with the workloads exec (default),
+// prepared, txn, select, scan and update. The last line of the output is
+// the total time of all workloads in seconds.
 int main(int argc, char **argv){
 #ifdef CONFIG_LIBUKALLOC_IFSTATS
 	get_ukalloc_stat();
 	while(1);
 #endif
 
-  char *zErrMsg = 0;
   int rc;
+  const char *default_workload = WORKLOAD;
+  const char **names = (const char **)argv + 1;
+  int nr_names = argc - 1;
+  // too large for the stack
+  static struct latency_hist lat;
+  unsigned long long total = 0;
+
+    if (nr_names <= 0) {
+        names = &default_workload;
+        nr_names = 1;
+    }
+    for (int i = 0; i < nr_names; i++) {
+        if (find_workload(names[i]) == NULL) {
+            fprintf(stderr, "Unknown workload %s\n", names[i]);
+            return 1;
+        }
+    }
 
     rc = sqlite3_open(DB_NAME, &db);
     if( rc ){
@@ -87,39 +339,20 @@ int main(int argc, char **argv){
         return(1);
     }
 
-    struct timespec start;
-    if (clock_gettime(CLOCK_MONOTONIC, &start)) {
-        perror("Could not read start time!");
-        sqlite3_close(db);
-        return 1;
-    }
-
-    for (int i = 0; i < OP_NUM; i++) {
-        rc = sqlite3_exec(db, DB_QUERY, callback, 0, &zErrMsg);
-
-        if( rc!=SQLITE_OK ){
-            fprintf(stderr, "SQL error: %s\n", zErrMsg);
-            sqlite3_free(zErrMsg);
-            break;
+    for (int i = 0; i < nr_names; i++) {
+        unsigned long long elapsed = run_workload(find_workload(names[i]),
+                                                  &lat);
+        if (elapsed == 0) {
+            sqlite3_close(db);
+            return 1;
         }
+        total += elapsed;
     }
-
-    struct timespec end;
-    if (clock_gettime(CLOCK_MONOTONIC, &end)) {
-        perror("Could not read end time!");
-        sqlite3_close(db);
-        return 1;
-    }
-
-    time_t n_sec = end.tv_sec - start.tv_sec;
-    long n_nsec = end.tv_nsec - start.tv_nsec;
-    if (n_nsec < 0) {
-        --n_sec;
-        n_nsec += 1000000000L;
-    }
-    printf("\n%ld.%09ld\n", n_sec, n_nsec);
+    printf("\n%llu.%09llu\n", total / NSEC_PER_SEC, total % NSEC_PER_SEC);
 
 #if VERIFY_Q
+    char *zErrMsg = 0;
+
     puts("========== Read back ===============");
     rc = sqlite3_exec(db, "SELECT * FROM tab", callback, 0, &zErrMsg);
     if( rc!=SQLITE_OK ){
@@ -128,6 +361,8 @@ int main(int argc, char **argv){
     }
 #endif
 
+    // a save started from the shell
+    (void)sqlite_save_wait();
     sqlite3_close(db);
 
     // Ensure output is printed and VM really quits
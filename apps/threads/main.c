@@ -2,17 +2,29 @@
 
 #include <uk/schedcoop.h>
 
+#include <pmu.h>
+
 struct arg {
 	int id;
 	int n;
+	int work; // loop iterations per step, to tell the threads apart
 };
 
+static void work(int n)
+{
+	volatile unsigned long sum = 0;
+
+	for (int i = 0; i < n; i++)
+		sum += i;
+}
+
 void thread(void *arg)
 {
 	struct arg *a = arg;
 	int i = 0;
 	for (i = 0; i < a->n; i++) {
 		printf("[Thread %d] %d\n", a->id, i);
+		work(a->work);
 		uk_sched_yield();
 		// ukschedcoop is not a preemptive scheduler
 		// This will stop the program
@@ -24,11 +36,15 @@ void thread(void *arg)
 int main()
 {
 	struct uk_thread *th1, *th2;
-	struct arg arg1 = {.id = 1, .n = 10};
-	struct arg arg2 = {.id = 2, .n = 10};
+	struct arg arg1 = {.id = 1, .n = 10, .work = 1000000};
+	struct arg arg2 = {.id = 2, .n = 10, .work = 100000};
+
+	// count instructions, cycles and LLC misses per thread
+	if (pmu_thread_start(NULL) < 0)
+		printf("per-thread counters not available\n");
 
 	th1 = uk_thread_create("thread1", thread, &arg1);
-	th2 = uk_thread_create("thread1", thread, &arg2);
+	th2 = uk_thread_create("thread2", thread, &arg2);
 	if (!th1 || !th2) {
 		printf("Failed to create a thread\n");
 		return 1;
@@ -36,6 +52,8 @@ int main()
 
 	uk_thread_wait(th1);
 	uk_thread_wait(th2);
+	pmu_thread_stop();
+	pmu_thread_print();
 	printf("exiting...\n");
 
 	return 0;
@@ -14,5 +14,11 @@
 
 #define bpf_notify ((void (*)(uint64_t function_address))8)
 #define bpf_get_ret_addr ((uint64_t(*)(const char *function_name))9)
+#define bpf_tail_call ((uint64_t(*)(void *ctx, uint64_t index))10)
+#define bpf_probe_read_bytes ((uint64_t(*)(void *dst, uint64_t size, uint64_t src))11)
+#define bpf_read_pmc ((uint64_t(*)(uint64_t idx))12)
+#define bpf_get_stack ((uint64_t(*)(void *buf, uint64_t size))13)
+#define bpf_get_stackid ((uint64_t(*)(uint64_t max_depth))14)
+#define bpf_printk ((uint64_t(*)(const char *fmt, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4))15)
 
 #endif /* BPF_HELPERS_H */
@@ -24,6 +24,36 @@ def main(port="/tmp/port0", txt="hello\n"):
         print(data.decode('utf-8'))
 
 
+def bench(port="/tmp/port0", size=1024, n=100):
+    """Send size bytes n times and wait for the echo of each"""
+    payload = b"x" * (size - 1) + b"\n"
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+        s.connect(port)
+        s.settimeout(5)
+        lat = []
+        for _ in range(n):
+            start = time.perf_counter()
+            s.sendall(payload)
+            received = 0
+            while received < size:
+                r = s.recv(65536)
+                if not r:
+                    sys.exit(f"connection closed after {received} of "
+                             f"{size} bytes")
+                received += len(r)
+            lat.append(time.perf_counter() - start)
+        lat.sort()
+        print(f"size={size} n={n} "
+              f"avg={sum(lat) / n * 1e6:.1f}us "
+              f"p50={lat[n // 2] * 1e6:.1f}us "
+              f"p99={lat[min(n - 1, n * 99 // 100)] * 1e6:.1f}us "
+              f"throughput={size * n / sum(lat) / 1e6:.2f}MB/s")
+
+
 if __name__ == "__main__":
     import fire
-    fire.Fire(main)
+    # without a command it sends txt and prints the echo, as it always did
+    if len(sys.argv) > 1 and sys.argv[1] == "bench":
+        fire.Fire(bench, command=sys.argv[2:])
+    else:
+        fire.Fire(main)
@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include <uk/console.h>
+#include <uk/essentials.h>
+#include <uk/plat/time.h>
+#include <uk/sched.h>
+#include <uk/wait.h>
+
+#include "console_io.h"
+
+// The console driver only offers uk_console_getc(), which blocks the calling
+// thread until a byte arrives. A reader thread moves the bytes into a ring
+// as they come in, so that readers get everything received so far with one
+// call. It only wakes readers when the ring stops being empty, once per
+// burst. When the ring is full it waits for space, leaving the input in the
+// virtqueue.
+//
+// This is not a bulk read: the reader thread still makes one getc per byte
+// and every byte is copied once more through the ring, with a thread switch
+// in between. Reading the virtqueue directly needs a receive call in the
+// virtio-console driver, which lives in the unikraft tree and isn't part of
+// this change.
+#define CONSOLE_IO_RING_SIZE 4096 // power of two
+#define CONSOLE_IO_WRITE_BUF 4096
+
+static char console_io_ring[CONSOLE_IO_RING_SIZE];
+static size_t console_io_head; // free running
+static size_t console_io_tail;
+static struct uk_waitq console_io_wq = UK_WAIT_QUEUE_INITIALIZER(console_io_wq);
+static struct uk_waitq console_io_space_wq =
+    UK_WAIT_QUEUE_INITIALIZER(console_io_space_wq);
+static struct uk_thread *console_io_thread;
+
+static char console_io_write_buf[CONSOLE_IO_WRITE_BUF];
+static struct console_io_stats console_io_st;
+
+static size_t console_io_used(void)
+{
+	return console_io_head - console_io_tail;
+}
+
+static void console_io_reader(void *arg __unused)
+{
+	for (;;) {
+		char ch = uk_console_getc();
+
+		if (console_io_used() == CONSOLE_IO_RING_SIZE) {
+			console_io_st.full_waits++;
+			uk_waitq_wait_event(&console_io_space_wq,
+					    console_io_used()
+						< CONSOLE_IO_RING_SIZE);
+		}
+		// readers only wait on an empty ring
+		int was_empty = console_io_used() == 0;
+
+		console_io_ring[console_io_head++ % CONSOLE_IO_RING_SIZE] = ch;
+		if (was_empty)
+			uk_waitq_wake_up(&console_io_wq);
+	}
+}
+
+int console_io_init(void)
+{
+	if (console_io_thread != NULL)
+		return 0;
+
+	console_io_thread =
+	    uk_thread_create("console_io", console_io_reader, NULL);
+	return console_io_thread != NULL ? 0 : -1;
+}
+
+ssize_t console_read(char *buf, size_t len, __nsec timeout)
+{
+	if (len == 0)
+		return 0;
+
+	if (console_io_used() == 0 && timeout != 0) {
+		if (timeout == CONSOLE_IO_FOREVER)
+			uk_waitq_wait_event(&console_io_wq,
+					    console_io_used() > 0);
+		else
+			uk_waitq_wait_event_deadline(
+			    &console_io_wq, console_io_used() > 0,
+			    ukplat_monotonic_clock() + timeout);
+	}
+
+	size_t n = MIN(len, console_io_used());
+	size_t off = console_io_tail % CONSOLE_IO_RING_SIZE;
+	size_t first = MIN(n, CONSOLE_IO_RING_SIZE - off);
+
+	int was_full = console_io_used() == CONSOLE_IO_RING_SIZE;
+
+	memcpy(buf, &console_io_ring[off], first);
+	memcpy(buf + first, console_io_ring, n - first);
+	console_io_tail += n;
+	if (n > 0) {
+		console_io_st.bytes_in += n;
+		console_io_st.reads++;
+		if (was_full)
+			uk_waitq_wake_up(&console_io_space_wq);
+	}
+	return n;
+}
+
+static void console_io_puts(const char *buf, size_t len)
+{
+	uk_console_puts((char *)buf, len);
+	console_io_st.bytes_out += len;
+	console_io_st.writes++;
+}
+
+ssize_t console_writev(const struct console_iovec *iov, int iovcnt)
+{
+	size_t buffered = 0;
+	ssize_t total = 0;
+
+	// a single segment needs no copy
+	if (iovcnt == 1) {
+		console_io_puts(iov[0].base, iov[0].len);
+		return iov[0].len;
+	}
+
+	for (int i = 0; i < iovcnt; i++) {
+		const char *base = iov[i].base;
+		size_t len = iov[i].len;
+
+		total += len;
+		if (buffered + len > CONSOLE_IO_WRITE_BUF && buffered > 0) {
+			console_io_puts(console_io_write_buf, buffered);
+			buffered = 0;
+		}
+		if (len > CONSOLE_IO_WRITE_BUF) {
+			console_io_puts(base, len);
+			continue;
+		}
+		memcpy(console_io_write_buf + buffered, base, len);
+		buffered += len;
+	}
+	if (buffered > 0)
+		console_io_puts(console_io_write_buf, buffered);
+	return total;
+}
+
+void console_io_stats(struct console_io_stats *stats)
+{
+	*stats = console_io_st;
+}
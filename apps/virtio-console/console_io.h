@@ -0,0 +1,36 @@
+#ifndef CONSOLE_IO_H
+#define CONSOLE_IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <uk/arch/time.h>
+
+// wait for input without a timeout
+#define CONSOLE_IO_FOREVER ((__nsec)-1)
+
+struct console_iovec {
+	const char *base;
+	size_t len;
+};
+
+struct console_io_stats {
+	__u64 bytes_in;  // bytes returned by console_read
+	__u64 reads;     // console_read calls that returned data
+	__u64 bytes_out;
+	__u64 writes;    // uk_console_puts calls
+	__u64 full_waits; // times the reader thread waited for ring space
+};
+
+int console_io_init(void);
+
+// Return the bytes received so far, up to len, in one call. If there are none
+// wait up to timeout ns (0 = don't wait) for input. Returns 0 on timeout.
+ssize_t console_read(char *buf, size_t len, __nsec timeout);
+
+// Write all segments with as few console writes as possible.
+ssize_t console_writev(const struct console_iovec *iov, int iovcnt);
+
+void console_io_stats(struct console_io_stats *stats);
+
+#endif /* CONSOLE_IO_H */
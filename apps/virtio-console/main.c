@@ -1,25 +1,44 @@
 #include <stdio.h>
 #include <unistd.h>
 
-#include <uk/console.h>
+#include "console_io.h"
 
-#define BUFSIZE 128
+#define BUFSIZE 4096
+// print the statistics after this much idle time
+#define IDLE_NS 1000000000ULL
 
+// Echo benchmark: everything received on the console is written back with
+// one read and one write per batch (see console.py bench).
 int main()
 {
-	int i = 0;
-	char buf[BUFSIZE + 1];
-	char ch = 0;
+	static char buf[BUFSIZE];
+	struct console_io_stats stats, last = {};
+
+	if (console_io_init() < 0) {
+		printf("Failed to start the console reader\n");
+		return 1;
+	}
 
 	while (1) {
-		if (i == BUFSIZE || ch == '\n') {
-			buf[i] = '\0';
-			printf("%s", buf);
-			uk_console_puts(buf, i);
-			i = 0;
+		ssize_t n = console_read(buf, sizeof(buf), IDLE_NS);
+		if (n > 0) {
+			struct console_iovec iov = {.base = buf, .len = n};
+			console_writev(&iov, 1);
+			continue;
 		}
-		ch = uk_console_getc();
-		buf[i++] = ch;
+
+		console_io_stats(&stats);
+		if (stats.reads == last.reads)
+			continue;
+		printf("echo: %lu bytes in %lu reads (%lu bytes/read), "
+		       "%lu writes, %lu full waits\n",
+		       (unsigned long)(stats.bytes_in - last.bytes_in),
+		       (unsigned long)(stats.reads - last.reads),
+		       (unsigned long)((stats.bytes_in - last.bytes_in)
+				       / (stats.reads - last.reads)),
+		       (unsigned long)(stats.writes - last.writes),
+		       (unsigned long)(stats.full_waits - last.full_waits));
+		last = stats;
 	}
 
 	return 0;
@@ -0,0 +1,46 @@
+#ifndef MEMTEL_H
+#define MEMTEL_H
+
+#include <uk/arch/types.h>
+
+// Size classes of the allocation counters: class 0 counts allocations of up
+// to 16 bytes, class i of up to 16 << i bytes, the last class everything
+// larger (page allocations included).
+#define MEMTEL_CLASSES 16
+#define MEMTEL_MIN_CLASS_SHIFT 4
+#define MEMTEL_EVENT_LEN 24
+
+struct memtel_sample {
+	__u64 seq;
+	__u64 ts; // ns, monotonic clock
+	char event[MEMTEL_EVENT_LEN]; // "" for periodic samples
+	__u64 availmem; // free memory of the default allocator
+	__u64 cur_mem_use; // with LIBUKALLOC_IFSTATS, else 0
+	// counters since the first memtel_start() or memtel_mark()
+	__u64 allocs;
+	__u64 frees;
+	__u64 failed;
+	__u64 alloc_bytes;
+	__u64 class_count[MEMTEL_CLASSES];
+	__u64 class_bytes[MEMTEL_CLASSES];
+};
+
+// Start (or change the period of) the sampler thread. 0 uses
+// CONFIG_LIBMEMTEL_PERIOD_MS.
+int memtel_start(unsigned int period_ms);
+void memtel_stop(void);
+
+// Record a sample now, labelled with event (copied), e.g. "bpf_attach".
+void memtel_mark(const char *event);
+
+// Copy sample seq into sample. Fails if it was overwritten or not taken yet.
+int memtel_read(__u64 seq, struct memtel_sample *sample);
+// sequence number of the next sample
+__u64 memtel_next_seq(void);
+
+// Print the samples from seq since on as tab separated lines starting with
+// "memtel", after a header line. puts_fn (e.g. ushell_puts) gets one line at
+// a time; NULL prints to the kernel console.
+void memtel_dump(__u64 since, void (*puts_fn)(char *line));
+
+#endif /* MEMTEL_H */
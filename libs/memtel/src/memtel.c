@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <uk/alloc.h>
+#include <uk/arch/time.h>
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/plat/time.h>
+#include <uk/sched.h>
+#include <uk/thread.h>
+
+#include <memtel.h>
+
+#define MEMTEL_RING_SIZE CONFIG_LIBMEMTEL_RING_SIZE
+#define MEMTEL_PAGE_SIZE 4096
+#define MEMTEL_LINE_LEN 1024
+
+struct memtel_counters {
+	__u64 allocs;
+	__u64 frees;
+	__u64 failed;
+	__u64 alloc_bytes;
+	__u64 class_count[MEMTEL_CLASSES];
+	__u64 class_bytes[MEMTEL_CLASSES];
+};
+
+static struct memtel_counters memtel_counters;
+static struct memtel_sample memtel_ring[MEMTEL_RING_SIZE];
+static __u64 memtel_seq; // next sample
+
+static struct uk_alloc *memtel_alloc;
+static struct uk_thread *memtel_thread;
+static int memtel_running;
+static __nsec memtel_period;
+
+// the original functions of the default allocator
+static uk_alloc_malloc_func_t memtel_malloc_orig;
+static uk_alloc_calloc_func_t memtel_calloc_orig;
+static uk_alloc_realloc_func_t memtel_realloc_orig;
+static uk_alloc_posix_memalign_func_t memtel_posix_memalign_orig;
+static uk_alloc_memalign_func_t memtel_memalign_orig;
+static uk_alloc_free_func_t memtel_free_orig;
+static uk_alloc_palloc_func_t memtel_palloc_orig;
+static uk_alloc_pfree_func_t memtel_pfree_orig;
+
+// malloc() of the default allocator is built on its palloc(): only count the
+// outermost call. The scheduler is cooperative and allocators don't yield.
+static int memtel_depth;
+
+static unsigned int memtel_class(__sz size)
+{
+	unsigned int class = 0;
+
+	while (class < MEMTEL_CLASSES - 1
+	       && size > (__sz)1 << (class + MEMTEL_MIN_CLASS_SHIFT))
+		class++;
+	return class;
+}
+
+static void memtel_count_alloc(__sz size, int ok)
+{
+	struct memtel_counters *c = &memtel_counters;
+	unsigned int class;
+
+	if (memtel_depth > 1)
+		return;
+	if (!ok) {
+		c->failed++;
+		return;
+	}
+	class = memtel_class(size);
+	c->allocs++;
+	c->alloc_bytes += size;
+	c->class_count[class]++;
+	c->class_bytes[class] += size;
+}
+
+static void memtel_count_free(void *ptr)
+{
+	if (memtel_depth <= 1 && ptr != NULL)
+		memtel_counters.frees++;
+}
+
+static void *memtel_malloc(struct uk_alloc *a, __sz size)
+{
+	void *p;
+
+	memtel_depth++;
+	p = memtel_malloc_orig(a, size);
+	memtel_count_alloc(size, p != NULL);
+	memtel_depth--;
+	return p;
+}
+
+static void *memtel_calloc(struct uk_alloc *a, __sz nmemb, __sz size)
+{
+	void *p;
+
+	memtel_depth++;
+	p = memtel_calloc_orig(a, nmemb, size);
+	memtel_count_alloc(nmemb * size, p != NULL);
+	memtel_depth--;
+	return p;
+}
+
+// counted as a free of the old block and an allocation of the new one
+static void *memtel_realloc(struct uk_alloc *a, void *ptr, __sz size)
+{
+	void *p;
+
+	memtel_depth++;
+	p = memtel_realloc_orig(a, ptr, size);
+	if (size > 0)
+		memtel_count_alloc(size, p != NULL);
+	if (p != NULL || size == 0)
+		memtel_count_free(ptr);
+	memtel_depth--;
+	return p;
+}
+
+static int memtel_posix_memalign(struct uk_alloc *a, void **memptr,
+				 __sz align, __sz size)
+{
+	int ret;
+
+	memtel_depth++;
+	ret = memtel_posix_memalign_orig(a, memptr, align, size);
+	memtel_count_alloc(size, ret == 0);
+	memtel_depth--;
+	return ret;
+}
+
+static void *memtel_memalign(struct uk_alloc *a, __sz align, __sz size)
+{
+	void *p;
+
+	memtel_depth++;
+	p = memtel_memalign_orig(a, align, size);
+	memtel_count_alloc(size, p != NULL);
+	memtel_depth--;
+	return p;
+}
+
+static void memtel_free(struct uk_alloc *a, void *ptr)
+{
+	memtel_depth++;
+	memtel_count_free(ptr);
+	memtel_free_orig(a, ptr);
+	memtel_depth--;
+}
+
+static void *memtel_palloc(struct uk_alloc *a, unsigned long num_pages)
+{
+	void *p;
+
+	memtel_depth++;
+	p = memtel_palloc_orig(a, num_pages);
+	memtel_count_alloc(num_pages * MEMTEL_PAGE_SIZE, p != NULL);
+	memtel_depth--;
+	return p;
+}
+
+static void memtel_pfree(struct uk_alloc *a, void *ptr, unsigned long num_pages)
+{
+	memtel_depth++;
+	memtel_count_free(ptr);
+	memtel_pfree_orig(a, ptr, num_pages);
+	memtel_depth--;
+}
+
+static int memtel_hook(void)
+{
+	struct uk_alloc *a;
+
+	if (memtel_alloc != NULL)
+		return 0;
+	a = uk_alloc_get_default();
+	if (a == NULL)
+		return -1;
+
+	memtel_malloc_orig = a->malloc;
+	memtel_calloc_orig = a->calloc;
+	memtel_realloc_orig = a->realloc;
+	memtel_posix_memalign_orig = a->posix_memalign;
+	memtel_memalign_orig = a->memalign;
+	memtel_free_orig = a->free;
+	memtel_palloc_orig = a->palloc;
+	memtel_pfree_orig = a->pfree;
+
+	a->malloc = memtel_malloc;
+	a->calloc = memtel_calloc;
+	a->realloc = memtel_realloc;
+	a->posix_memalign = memtel_posix_memalign;
+	a->memalign = memtel_memalign;
+	a->free = memtel_free;
+	if (a->palloc != NULL)
+		a->palloc = memtel_palloc;
+	if (a->pfree != NULL)
+		a->pfree = memtel_pfree;
+	memtel_alloc = a;
+	return 0;
+}
+
+static void memtel_record(const char *event)
+{
+	struct memtel_sample *s = &memtel_ring[memtel_seq % MEMTEL_RING_SIZE];
+	struct memtel_counters *c = &memtel_counters;
+	long availmem = uk_alloc_availmem(memtel_alloc);
+
+	memset(s, 0, sizeof(*s));
+	s->seq = memtel_seq;
+	s->ts = ukplat_monotonic_clock();
+	// one field of the dump
+	for (unsigned int i = 0; event != NULL && event[i] != '\0'
+				 && i < sizeof(s->event) - 1; i++)
+		s->event[i] = event[i] == '\t' || event[i] == ' '
+				  || event[i] == '\n' ? '_' : event[i];
+	s->availmem = availmem > 0 ? availmem : 0;
+#ifdef CONFIG_LIBUKALLOC_IFSTATS
+	{
+		struct uk_alloc_stats stat = {};
+
+		uk_alloc_stats_get(memtel_alloc, &stat);
+		s->cur_mem_use = stat.cur_mem_use;
+	}
+#endif
+	s->allocs = c->allocs;
+	s->frees = c->frees;
+	s->failed = c->failed;
+	s->alloc_bytes = c->alloc_bytes;
+	memcpy(s->class_count, c->class_count, sizeof(s->class_count));
+	memcpy(s->class_bytes, c->class_bytes, sizeof(s->class_bytes));
+	memtel_seq++;
+}
+
+static void memtel_sampler(void *arg __unused)
+{
+	while (memtel_running) {
+		memtel_record(NULL);
+		uk_sched_thread_sleep(memtel_period);
+	}
+	memtel_thread = NULL;
+}
+
+int memtel_start(unsigned int period_ms)
+{
+	if (memtel_hook() < 0)
+		return -1;
+
+	memtel_period = ukarch_time_msec_to_nsec(
+	    period_ms ? period_ms : CONFIG_LIBMEMTEL_PERIOD_MS);
+	memtel_running = 1;
+	// a stopped thread that is still sleeping carries on
+	if (memtel_thread != NULL)
+		return 0;
+
+	memtel_thread = uk_thread_create("memtel", memtel_sampler, NULL);
+	if (memtel_thread == NULL) {
+		memtel_running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void memtel_stop(void)
+{
+	// the thread exits when it wakes up
+	memtel_running = 0;
+}
+
+void memtel_mark(const char *event)
+{
+	if (memtel_hook() < 0)
+		return;
+	memtel_record(event != NULL ? event : "mark");
+}
+
+__u64 memtel_next_seq(void)
+{
+	return memtel_seq;
+}
+
+int memtel_read(__u64 seq, struct memtel_sample *sample)
+{
+	if (seq >= memtel_seq || memtel_seq - seq > MEMTEL_RING_SIZE)
+		return -1;
+	*sample = memtel_ring[seq % MEMTEL_RING_SIZE];
+	return 0;
+}
+
+static void memtel_puts(void (*puts_fn)(char *line), char *line)
+{
+	if (puts_fn != NULL)
+		puts_fn(line);
+	else
+		printf("%s", line);
+}
+
+// column of a size class: its upper bound, for the last class the bound of
+// the class before it that its allocations exceed
+static int memtel_class_column(char *buf, __sz len, const char *name,
+			       unsigned int class)
+{
+	if (class == MEMTEL_CLASSES - 1)
+		return snprintf(buf, len, "\t%s_>%lu", name,
+				1UL << (class - 1 + MEMTEL_MIN_CLASS_SHIFT));
+	return snprintf(buf, len, "\t%s_%lu", name,
+			1UL << (class + MEMTEL_MIN_CLASS_SHIFT));
+}
+
+void memtel_dump(__u64 since, void (*puts_fn)(char *line))
+{
+	char line[MEMTEL_LINE_LEN];
+	struct memtel_sample s;
+	int n;
+
+	n = snprintf(line, sizeof(line),
+		     "memtel\tseq\tts_ns\tevent\tavailmem\tcur_mem_use\tallocs"
+		     "\tfrees\tfailed\talloc_bytes");
+	for (unsigned int i = 0; i < MEMTEL_CLASSES; i++)
+		n += memtel_class_column(line + n, sizeof(line) - n, "count",
+					 i);
+	for (unsigned int i = 0; i < MEMTEL_CLASSES; i++)
+		n += memtel_class_column(line + n, sizeof(line) - n, "bytes",
+					 i);
+	snprintf(line + n, sizeof(line) - n, "\n");
+	memtel_puts(puts_fn, line);
+
+	// skip what was overwritten already
+	if (memtel_seq > MEMTEL_RING_SIZE && since < memtel_seq - MEMTEL_RING_SIZE)
+		since = memtel_seq - MEMTEL_RING_SIZE;
+
+	for (__u64 seq = since; memtel_read(seq, &s) == 0; seq++) {
+		n = snprintf(line, sizeof(line),
+			     "memtel\t%lu\t%lu\t%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu",
+			     (unsigned long)s.seq, (unsigned long)s.ts,
+			     s.event[0] ? s.event : "-",
+			     (unsigned long)s.availmem,
+			     (unsigned long)s.cur_mem_use,
+			     (unsigned long)s.allocs, (unsigned long)s.frees,
+			     (unsigned long)s.failed,
+			     (unsigned long)s.alloc_bytes);
+		for (unsigned int i = 0; i < MEMTEL_CLASSES; i++)
+			n += snprintf(line + n, sizeof(line) - n, "\t%lu",
+				      (unsigned long)s.class_count[i]);
+		for (unsigned int i = 0; i < MEMTEL_CLASSES; i++)
+			n += snprintf(line + n, sizeof(line) - n, "\t%lu",
+				      (unsigned long)s.class_bytes[i]);
+		snprintf(line + n, sizeof(line) - n, "\n");
+		memtel_puts(puts_fn, line);
+	}
+}
@@ -0,0 +1,157 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <uk/arch/types.h>
+
+// cf. Intel SDM CHAPTER 19 PERFORMANCE MONITORING
+
+#define IA32_PERF_EVENTSEL0 0x186
+#define IA32_PERF_EVENTSEL1 0x187
+
+#define IA32_PERF_PERFCTR0 0xc1
+#define IA32_PERF_PERFCTR1 0xc2
+
+#define IA32_PERF_GLOBAL_STATUS 0x38e
+#define IA32_PERF_GLOBAL_CTRL 0x38f
+#define IA32_PERF_GLOBAL_OVF_CTRL 0x390
+
+#define IA32_FIXED_CTR_CTRL 0x38d
+#define IA32_FIXED_CTR0 0x309 // Instructions Retired
+#define IA32_FIXED_CTR1 0x30a // Unhalted CPU Cycles
+#define IA32_FIXED_CTR2 0x30b // Reference CPU Cycles
+
+// event select bits
+#define EVENTSEL_USR (1 << 16)
+#define EVENTSEL_OS (1 << 17)
+#define EVENTSEL_INT (1 << 20)
+#define EVENTSEL_EN (1 << 22)
+
+#define PMU_MAX_COUNTERS 8
+#define PMU_MAX_FIXED_COUNTERS 3
+#define PMU_GROUP_MAX_EVENTS 16
+
+// rdpmc index of fixed counters
+#define PMU_RDPMC_FIXED (1 << 30)
+
+// event 0x00 is the architectural pseudo-encoding of events that only a
+// fixed counter counts (ref-cycles), they can't be multiplexed
+#define PMU_EVENT_FIXED_ONLY 0x00
+
+struct pmu_event {
+	const char *name;
+	__u8 event;
+	__u8 umask;
+	int fixed; // fixed counter counting the same event, or -1
+};
+
+struct pmu_group_event {
+	const struct pmu_event *event;
+	int counter;	    // general counter while scheduled, or -1
+	int fixed;	    // fixed counter used for the whole run, or -1
+	__u64 start;	    // counter value at the start of the slice
+	__u64 count;	    // events counted while scheduled
+	__u64 time_running; // ns spent on a counter
+};
+
+// A set of events counted together. Events without a fixed counter share
+// the general counters in turns, pmu_group_rotate() switches to the next
+// ones and values are scaled by time_enabled / time_running.
+struct pmu_group {
+	unsigned int nr_events;
+	struct pmu_group_event events[PMU_GROUP_MAX_EVENTS];
+	unsigned int next; // first multiplexed event of the next slice
+	__u64 time_enabled;
+	__u64 slice_start;
+	int running;
+};
+
+#define PMU_THREAD_MAX_EVENTS (PMU_MAX_FIXED_COUNTERS + PMU_MAX_COUNTERS)
+#define PMU_THREAD_DEFAULT_EVENTS "instructions,cycles,llc-misses"
+
+// events counted while a thread was running, in pmu_thread_start() order
+struct pmu_thread_counts {
+	__u64 count[PMU_THREAD_MAX_EVENTS];
+	__u64 switches; // times the thread was switched out
+};
+
+static inline void cpuid(__u32 fn, __u32 subfn, __u32 *eax, __u32 *ebx,
+			 __u32 *ecx, __u32 *edx)
+{
+	asm volatile("cpuid"
+		     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		     : "a"(fn), "c"(subfn));
+}
+
+static inline void rdmsr(unsigned int msr, __u32 *lo, __u32 *hi)
+{
+	asm volatile("rdmsr" : "=a"(*lo), "=d"(*hi) : "c"(msr));
+}
+
+static inline __u64 rdmsrl(unsigned int msr)
+{
+	__u32 lo, hi;
+
+	rdmsr(msr, &lo, &hi);
+	return ((__u64)lo | (__u64)hi << 32);
+}
+
+static inline void wrmsr(unsigned int msr, __u32 lo, __u32 hi)
+{
+	asm volatile("wrmsr"
+		     : /* no outputs */
+		     : "c"(msr), "a"(lo), "d"(hi));
+}
+
+static inline void wrmsrl(unsigned int msr, __u64 val)
+{
+	wrmsr(msr, (__u32)(val & 0xffffffffULL), (__u32)(val >> 32));
+}
+
+// ecx selects a general counter, or a fixed one with bit 30 set
+static inline __u64 rdpmc(__u32 ecx)
+{
+	__u32 lo, hi;
+
+	asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(ecx));
+	return ((__u64)lo | (__u64)hi << 32);
+}
+
+// CPUID.0AH: EAX[7:0] > 0
+int check_pmc();
+
+int pmu_init(void);
+int pmu_num_counters(void);
+void pmu_global_ctrl_update(__u64 set, __u64 clear);
+int pmu_counter_reserve(void);
+void pmu_counter_release(unsigned int idx);
+int pmu_counter_enable(unsigned int idx, __u8 event, __u8 umask);
+void pmu_counter_disable(unsigned int idx);
+__u64 pmu_read(unsigned int idx);
+
+int pmu_enable_instruction_retired(unsigned int idx);
+int pmu_enable_llc_misses(unsigned int idx);
+
+int pmu_num_fixed_counters(void);
+int pmu_fixed_enable(unsigned int idx);
+void pmu_fixed_disable(unsigned int idx);
+__u64 pmu_read_fixed(unsigned int idx);
+__u64 pmu_counter_width_mask(int fixed);
+
+const struct pmu_event *pmu_event_find(const char *name);
+void pmu_event_list(void);
+
+int pmu_group_init(struct pmu_group *group, const char *names);
+int pmu_group_start(struct pmu_group *group);
+void pmu_group_rotate(struct pmu_group *group);
+void pmu_group_stop(struct pmu_group *group);
+__u64 pmu_group_value(const struct pmu_group *group, unsigned int idx);
+void pmu_group_print(const struct pmu_group *group);
+
+struct uk_thread;
+
+int pmu_thread_start(const char *events);
+void pmu_thread_stop(void);
+int pmu_thread_read(struct uk_thread *thread, struct pmu_thread_counts *counts);
+void pmu_thread_print(void);
+
+#endif /* PMU_H */
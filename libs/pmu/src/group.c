@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <uk/plat/time.h>
+
+#include <pmu.h>
+
+#define PMU_GROUP_MAX_NAMES 512
+
+// Parse a comma separated list of event names. Events with a fixed counter
+// get it for the whole run, every other event is multiplexed.
+int pmu_group_init(struct pmu_group *group, const char *names)
+{
+	char buf[PMU_GROUP_MAX_NAMES];
+	__u32 fixed_used = 0;
+
+	memset(group, 0, sizeof(*group));
+	if (pmu_init() < 0)
+		return -1;
+	if (strlen(names) >= sizeof(buf))
+		return -1;
+	strcpy(buf, names);
+
+	for (char *name = buf, *end; name != NULL; name = end) {
+		end = strchr(name, ',');
+		if (end != NULL)
+			*end++ = '\0';
+		if (*name == '\0')
+			continue;
+
+		const struct pmu_event *event = pmu_event_find(name);
+		if (event == NULL) {
+			printf("unknown event %s\n", name);
+			return -1;
+		}
+		if (group->nr_events == PMU_GROUP_MAX_EVENTS) {
+			printf("too many events (max %d)\n",
+			       PMU_GROUP_MAX_EVENTS);
+			return -1;
+		}
+
+		struct pmu_group_event *ge = &group->events[group->nr_events++];
+		ge->event = event;
+		ge->counter = -1;
+		ge->fixed = -1;
+		if (event->fixed >= 0 && event->fixed < pmu_num_fixed_counters()
+		    && !(fixed_used & (1 << event->fixed))) {
+			ge->fixed = event->fixed;
+			fixed_used |= 1 << event->fixed;
+		} else if (event->event == PMU_EVENT_FIXED_ONLY) {
+			printf("%s needs fixed counter %d\n", name,
+			       event->fixed);
+			return -1;
+		}
+	}
+	return group->nr_events > 0 ? 0 : -1;
+}
+
+static unsigned int pmu_group_nr_multiplexed(const struct pmu_group *group)
+{
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < group->nr_events; i++)
+		n += group->events[i].fixed < 0;
+	return n;
+}
+
+// put the next multiplexed events on the general counters
+static unsigned int pmu_group_schedule(struct pmu_group *group)
+{
+	unsigned int nr_counters = pmu_num_counters();
+	unsigned int scheduled = 0;
+	unsigned int first = group->next;
+
+	for (unsigned int i = 0; i < group->nr_events && scheduled < nr_counters;
+	     i++) {
+		unsigned int idx = (first + i) % group->nr_events;
+		struct pmu_group_event *ge = &group->events[idx];
+
+		if (ge->fixed >= 0)
+			continue;
+		if (pmu_counter_enable(scheduled, ge->event->event,
+				       ge->event->umask) < 0)
+			break;
+		ge->counter = scheduled++;
+		ge->start = 0;
+		// the next slice continues after this event
+		group->next = (idx + 1) % group->nr_events;
+	}
+	return scheduled;
+}
+
+static void pmu_group_unschedule(struct pmu_group *group)
+{
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		struct pmu_group_event *ge = &group->events[i];
+
+		if (ge->counter >= 0) {
+			pmu_counter_disable(ge->counter);
+			ge->counter = -1;
+		}
+	}
+}
+
+// fold what the counters saw since the start of the slice into the group
+static void pmu_group_account(struct pmu_group *group)
+{
+	__u64 now = ukplat_monotonic_clock();
+	__u64 elapsed = now - group->slice_start;
+
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		struct pmu_group_event *ge = &group->events[i];
+		__u64 value;
+
+		if (ge->fixed >= 0)
+			value = pmu_read_fixed(ge->fixed);
+		else if (ge->counter >= 0)
+			value = pmu_read(ge->counter);
+		else
+			continue;
+
+		ge->count += (value - ge->start)
+			     & pmu_counter_width_mask(ge->fixed >= 0);
+		ge->start = value;
+		ge->time_running += elapsed;
+	}
+	group->time_enabled += elapsed;
+	group->slice_start = now;
+}
+
+int pmu_group_start(struct pmu_group *group)
+{
+	if (group->nr_events == 0)
+		return -1;
+
+	group->time_enabled = 0;
+	group->next = 0;
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		struct pmu_group_event *ge = &group->events[i];
+
+		ge->count = 0;
+		ge->time_running = 0;
+		if (ge->fixed >= 0) {
+			pmu_fixed_enable(ge->fixed);
+			ge->start = pmu_read_fixed(ge->fixed);
+		}
+	}
+	pmu_group_schedule(group);
+	group->slice_start = ukplat_monotonic_clock();
+	group->running = 1;
+	return 0;
+}
+
+// Switch the general counters to the next events. Call it periodically
+// (e.g. every few ms) while the group runs; the more often, the better the
+// scaled values of multiplexed events.
+void pmu_group_rotate(struct pmu_group *group)
+{
+	unsigned int nr_multiplexed = pmu_group_nr_multiplexed(group);
+
+	if (!group->running)
+		return;
+
+	pmu_group_account(group);
+	if (nr_multiplexed <= (unsigned int)pmu_num_counters())
+		return;
+
+	// reprogram the counters in place, only the ones left over are
+	// disabled
+	unsigned int used = 0;
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		if (group->events[i].counter >= 0) {
+			group->events[i].counter = -1;
+			used++;
+		}
+	}
+	for (unsigned int c = pmu_group_schedule(group); c < used; c++)
+		pmu_counter_disable(c);
+}
+
+void pmu_group_stop(struct pmu_group *group)
+{
+	if (!group->running)
+		return;
+
+	pmu_group_account(group);
+	pmu_group_unschedule(group);
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		if (group->events[i].fixed >= 0)
+			pmu_fixed_disable(group->events[i].fixed);
+	}
+	group->running = 0;
+}
+
+// count of event idx, scaled up to the whole time the group was enabled
+__u64 pmu_group_value(const struct pmu_group *group, unsigned int idx)
+{
+	const struct pmu_group_event *ge = &group->events[idx];
+
+	if (ge->time_running == 0)
+		return 0;
+	if (ge->time_running >= group->time_enabled)
+		return ge->count;
+	return (unsigned __int128)ge->count * group->time_enabled
+	       / ge->time_running;
+}
+
+static int pmu_group_find(const struct pmu_group *group, const char *name)
+{
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		if (strcmp(group->events[i].event->name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// value of a named event in hundredths of a percent of total
+static __u64 pmu_group_share(const struct pmu_group *group, int idx,
+			     __u64 total)
+{
+	return total ? pmu_group_value(group, idx) * 10000 / total : 0;
+}
+
+void pmu_group_print(const struct pmu_group *group)
+{
+	for (unsigned int i = 0; i < group->nr_events; i++) {
+		const struct pmu_group_event *ge = &group->events[i];
+
+		printf("%16lu %-24s", pmu_group_value(group, i),
+		       ge->event->name);
+		if (ge->time_running < group->time_enabled) {
+			__u64 running = group->time_enabled
+					    ? ge->time_running * 10000
+						  / group->time_enabled
+					    : 0;
+			printf(" (%lu.%02lu%%)", running / 100, running % 100);
+		}
+		printf("\n");
+	}
+
+	int instructions = pmu_group_find(group, "instructions");
+	int cycles = pmu_group_find(group, "cycles");
+	if (instructions >= 0 && cycles >= 0 && pmu_group_value(group, cycles)) {
+		__u64 ipc = pmu_group_value(group, instructions) * 100
+			    / pmu_group_value(group, cycles);
+		printf("%13lu.%02lu insn per cycle\n", ipc / 100, ipc % 100);
+	}
+
+	// top-down level 1 with 4 issue slots per cycle
+	int issued = pmu_group_find(group, "uops-issued");
+	int retired = pmu_group_find(group, "uops-retired-slots");
+	int not_delivered = pmu_group_find(group, "idq-uops-not-delivered");
+	int recovery = pmu_group_find(group, "recovery-cycles");
+	if (cycles < 0 || issued < 0 || retired < 0 || not_delivered < 0
+	    || recovery < 0)
+		return;
+
+	__u64 slots = 4 * pmu_group_value(group, cycles);
+	__u64 frontend = pmu_group_share(group, not_delivered, slots);
+	__u64 retiring = pmu_group_share(group, retired, slots);
+	__u64 bad_speculation = 0;
+	if (slots) {
+		__u64 wasted = pmu_group_value(group, issued)
+			       - pmu_group_value(group, retired)
+			       + 4 * pmu_group_value(group, recovery);
+		if (pmu_group_value(group, issued)
+		    >= pmu_group_value(group, retired))
+			bad_speculation = wasted * 10000 / slots;
+	}
+	__u64 used = frontend + retiring + bad_speculation;
+	__u64 backend = used < 10000 ? 10000 - used : 0;
+
+	printf("top-down: frontend bound %lu.%02lu%%, bad speculation "
+	       "%lu.%02lu%%, retiring %lu.%02lu%%, backend bound %lu.%02lu%%\n",
+	       frontend / 100, frontend % 100, bad_speculation / 100,
+	       bad_speculation % 100, retiring / 100, retiring % 100,
+	       backend / 100, backend % 100);
+}
@@ -0,0 +1,239 @@
+#include <pmu.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static int pmu_counters = -1;
+static int pmu_fixed_counters;
+static __u64 pmu_counter_mask;
+static __u64 pmu_fixed_mask;
+static __u32 pmu_enabled; // bitmap of counters set up by pmu_counter_enable
+// the top pmu_reserved general counters belong to pmu_counter_reserve() users
+static int pmu_reserved;
+static __u32 pmu_fixed_enabled;
+// shadows of the control MSRs, so that (re)programming a counter doesn't
+// need an rdmsr, which traps to the hypervisor
+static __u64 pmu_global_ctrl;
+static __u64 pmu_fixed_ctrl;
+
+// events with a fixed counter first, the rest use the general counters
+static const struct pmu_event pmu_events[] = {
+	{"instructions", 0xc0, 0x00, 0},
+	{"cycles", 0x3c, 0x00, 1},
+	// not 0x3c/0x01, which counts bus clock ticks on many parts
+	{"ref-cycles", PMU_EVENT_FIXED_ONLY, 0x03, 2},
+	{"llc-references", 0x2e, 0x4f, -1},
+	{"llc-misses", 0x2e, 0x41, -1},
+	{"branch-instructions", 0xc4, 0x00, -1},
+	{"branch-misses", 0xc5, 0x00, -1},
+	// top-down level 1 inputs, Skylake event codes
+	{"uops-issued", 0x0e, 0x01, -1},
+	{"uops-retired-slots", 0xc2, 0x02, -1},
+	{"idq-uops-not-delivered", 0x9c, 0x01, -1},
+	{"recovery-cycles", 0x0d, 0x01, -1},
+};
+
+int check_pmc()
+{
+	__u32 eax, ebx, ecx, edx;
+	cpuid(0x0A, 0, &eax, &ebx, &ecx, &edx);
+	int version = eax & 0xff;
+	return version > 0;
+}
+
+#define CR4_PCE (1 << 8)
+
+// allow rdpmc outside of ring 0 as well, e.g. for code running with a
+// lower CPL than the kernel
+static void pmu_enable_rdpmc(void)
+{
+	unsigned long cr4;
+
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	if (!(cr4 & CR4_PCE))
+		asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PCE));
+}
+
+int pmu_init(void)
+{
+	__u32 eax, ebx, ecx, edx;
+
+	if (pmu_counters >= 0)
+		return pmu_counters;
+	if (!check_pmc())
+		return -1;
+
+	cpuid(0x0A, 0, &eax, &ebx, &ecx, &edx);
+	pmu_counters = (eax >> 8) & 0xff;
+	if (pmu_counters > PMU_MAX_COUNTERS)
+		pmu_counters = PMU_MAX_COUNTERS;
+	pmu_counter_mask = (1ULL << ((eax >> 16) & 0xff)) - 1;
+
+	// fixed counters are enumerated from version 2 on
+	if ((eax & 0xff) >= 2) {
+		pmu_fixed_counters = edx & 0x1f;
+		if (pmu_fixed_counters > PMU_MAX_FIXED_COUNTERS)
+			pmu_fixed_counters = PMU_MAX_FIXED_COUNTERS;
+		pmu_fixed_mask = (1ULL << ((edx >> 5) & 0xff)) - 1;
+		pmu_fixed_ctrl = rdmsrl(IA32_FIXED_CTR_CTRL);
+	}
+	pmu_global_ctrl = rdmsrl(IA32_PERF_GLOBAL_CTRL);
+	pmu_enable_rdpmc();
+	return pmu_counters;
+}
+
+void pmu_global_ctrl_update(__u64 set, __u64 clear)
+{
+	__u64 ctrl = (pmu_global_ctrl | set) & ~clear;
+
+	if (ctrl != pmu_global_ctrl) {
+		pmu_global_ctrl = ctrl;
+		wrmsrl(IA32_PERF_GLOBAL_CTRL, ctrl);
+	}
+}
+
+// general counters available to pmu_counter_enable(), groups and threads
+int pmu_num_counters(void)
+{
+	return pmu_counters < 0 ? 0 : pmu_counters - pmu_reserved;
+}
+
+// Take the highest general counter for a user that programs it itself (the
+// sampling profiler), so that pmu_counter_enable(), groups and threads never
+// touch it. Returns its index, or -1 if it is in use or there is none left.
+int pmu_counter_reserve(void)
+{
+	if (pmu_init() < 0 || pmu_num_counters() == 0)
+		return -1;
+
+	int idx = pmu_counters - pmu_reserved - 1;
+
+	if (pmu_enabled & (1 << idx))
+		return -1;
+	pmu_reserved++;
+	return idx;
+}
+
+// give back the last counter returned by pmu_counter_reserve()
+void pmu_counter_release(unsigned int idx)
+{
+	if (pmu_reserved == 0
+	    || idx != (unsigned int)(pmu_counters - pmu_reserved))
+		return;
+	pmu_reserved--;
+}
+
+int pmu_counter_enable(unsigned int idx, __u8 event, __u8 umask)
+{
+	if (pmu_init() < 0 || idx >= (unsigned int)pmu_num_counters())
+		return -1;
+
+	wrmsrl(IA32_PERF_EVENTSEL0 + idx, EVENTSEL_EN | EVENTSEL_OS
+						  | EVENTSEL_USR
+						  | ((__u64)umask << 8) | event);
+	wrmsrl(IA32_PERF_PERFCTR0 + idx, 0);
+	pmu_global_ctrl_update(1ULL << idx, 0);
+	pmu_enabled |= 1 << idx;
+	return 0;
+}
+
+void pmu_counter_disable(unsigned int idx)
+{
+	if (!(pmu_enabled & (1 << idx)))
+		return;
+
+	pmu_enabled &= ~(1 << idx);
+	wrmsrl(IA32_PERF_EVENTSEL0 + idx, 0);
+	pmu_global_ctrl_update(0, 1ULL << idx);
+}
+
+// rdpmc faults on counters the CPU doesn't have, so idx is checked here
+// rather than by the callers (BPF programs among them)
+__u64 pmu_read(unsigned int idx)
+{
+	if (idx >= PMU_MAX_COUNTERS || !(pmu_enabled & (1 << idx)))
+		return 0;
+	return rdpmc(idx);
+}
+
+int pmu_enable_instruction_retired(unsigned int idx)
+{
+	return pmu_counter_enable(idx, 0xc0, 0x00);
+}
+
+int pmu_enable_llc_misses(unsigned int idx)
+{
+	return pmu_counter_enable(idx, 0x2e, 0x41);
+}
+
+int pmu_num_fixed_counters(void)
+{
+	return pmu_fixed_counters;
+}
+
+int pmu_fixed_enable(unsigned int idx)
+{
+	if (pmu_init() < 0 || idx >= (unsigned int)pmu_fixed_counters)
+		return -1;
+
+	// 4 bits per counter, count in ring 0 and 3
+	pmu_fixed_ctrl &= ~(0xfULL << (4 * idx));
+	pmu_fixed_ctrl |= 0x3ULL << (4 * idx);
+	wrmsrl(IA32_FIXED_CTR_CTRL, pmu_fixed_ctrl);
+	pmu_global_ctrl_update(1ULL << (32 + idx), 0);
+	pmu_fixed_enabled |= 1 << idx;
+	return 0;
+}
+
+void pmu_fixed_disable(unsigned int idx)
+{
+	if (!(pmu_fixed_enabled & (1 << idx)))
+		return;
+
+	pmu_fixed_enabled &= ~(1 << idx);
+	pmu_fixed_ctrl &= ~(0xfULL << (4 * idx));
+	wrmsrl(IA32_FIXED_CTR_CTRL, pmu_fixed_ctrl);
+	pmu_global_ctrl_update(0, 1ULL << (32 + idx));
+}
+
+__u64 pmu_read_fixed(unsigned int idx)
+{
+	if (idx >= PMU_MAX_FIXED_COUNTERS || !(pmu_fixed_enabled & (1 << idx)))
+		return 0;
+	return rdpmc(PMU_RDPMC_FIXED | idx);
+}
+
+// counters are narrower than 64 bits, deltas are taken modulo their width
+__u64 pmu_counter_width_mask(int fixed)
+{
+	return fixed ? pmu_fixed_mask : pmu_counter_mask;
+}
+
+const struct pmu_event *pmu_event_find(const char *name)
+{
+	for (unsigned int i = 0; i < sizeof(pmu_events) / sizeof(pmu_events[0]);
+	     i++) {
+		if (strcmp(pmu_events[i].name, name) == 0)
+			return &pmu_events[i];
+	}
+	return NULL;
+}
+
+void pmu_event_list(void)
+{
+	pmu_init();
+	printf("%d general counters, %d fixed counters\n", pmu_num_counters(),
+	       pmu_num_fixed_counters());
+	for (unsigned int i = 0; i < sizeof(pmu_events) / sizeof(pmu_events[0]);
+	     i++) {
+		const struct pmu_event *event = &pmu_events[i];
+
+		printf("  %-24s event=%#04x umask=%#04x%s\n", event->name,
+		       event->event, event->umask,
+		       event->event == PMU_EVENT_FIXED_ONLY
+			   ? " (fixed only)"
+		       : event->fixed >= 0 && event->fixed < pmu_fixed_counters
+			   ? " (fixed)"
+			   : "");
+	}
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <uk/sched.h>
+#include <uk/thread.h>
+
+#include <pmu.h>
+
+#define PMU_THREAD_MAX 32
+#define PMU_THREAD_NAME_LEN 32
+#define PMU_THREAD_MAX_NAMES 512
+
+struct pmu_thread_slot {
+	struct uk_thread *thread; // NULL once the thread has exited
+	int used;
+	char name[PMU_THREAD_NAME_LEN];
+	struct pmu_thread_counts counts;
+};
+
+static struct pmu_thread_slot pmu_threads[PMU_THREAD_MAX];
+static __u64 pmu_thread_lost; // switches of threads that didn't get a slot
+
+static unsigned int pmu_thread_nr_events;
+static const struct pmu_event *pmu_thread_events[PMU_THREAD_MAX_EVENTS];
+static __u32 pmu_thread_rdpmc[PMU_THREAD_MAX_EVENTS]; // rdpmc index
+static __u64 pmu_thread_mask[PMU_THREAD_MAX_EVENTS];
+static __u64 pmu_thread_last[PMU_THREAD_MAX_EVENTS]; // values at last switch
+
+static struct uk_sched *pmu_thread_sched;
+static ukplat_ctx_switch_func_t pmu_thread_switch_orig;
+
+static struct pmu_thread_slot *pmu_thread_slot(struct uk_thread *thread,
+					       int create)
+{
+	struct pmu_thread_slot *free = NULL, *exited = NULL;
+
+	for (unsigned int i = 0; i < PMU_THREAD_MAX; i++) {
+		struct pmu_thread_slot *slot = &pmu_threads[i];
+
+		if (slot->used && slot->thread == thread)
+			return slot;
+		if (!slot->used && free == NULL)
+			free = slot;
+		if (slot->used && slot->thread == NULL && exited == NULL)
+			exited = slot;
+	}
+	if (!create)
+		return NULL;
+
+	// keep the counts of exited threads as long as there is room
+	if (free == NULL)
+		free = exited;
+	if (free == NULL)
+		return NULL;
+
+	memset(free, 0, sizeof(*free));
+	free->used = 1;
+	free->thread = thread;
+	strncpy(free->name, thread->name ? thread->name : "?",
+		sizeof(free->name) - 1);
+	return free;
+}
+
+// charge the events since the last switch to slot (may be NULL)
+static void pmu_thread_account(struct pmu_thread_slot *slot)
+{
+	for (unsigned int i = 0; i < pmu_thread_nr_events; i++) {
+		__u64 now = rdpmc(pmu_thread_rdpmc[i]);
+
+		if (slot != NULL)
+			slot->counts.count[i] +=
+			    (now - pmu_thread_last[i]) & pmu_thread_mask[i];
+		pmu_thread_last[i] = now;
+	}
+}
+
+// Installed as the switch callback of the scheduler. It runs on the stack of
+// the outgoing thread, so everything counted since the last switch is
+// charged to uk_thread_current().
+static void pmu_thread_switch(void *prevctx, void *nextctx)
+{
+	struct pmu_thread_slot *slot = pmu_thread_slot(uk_thread_current(), 1);
+
+	pmu_thread_account(slot);
+	if (slot != NULL)
+		slot->counts.switches++;
+	else
+		pmu_thread_lost++;
+	pmu_thread_switch_orig(prevctx, nextctx);
+}
+
+static int pmu_thread_init(struct uk_thread *thread)
+{
+	// list new threads before they first run
+	if (pmu_thread_sched != NULL)
+		pmu_thread_slot(thread, 1);
+	return 0;
+}
+
+static void pmu_thread_fini(struct uk_thread *thread)
+{
+	struct pmu_thread_slot *slot = pmu_thread_slot(thread, 0);
+
+	// the uk_thread is freed, its counts stay until the slot is reused
+	if (slot != NULL)
+		slot->thread = NULL;
+}
+
+UK_THREAD_INIT(pmu_thread_init, pmu_thread_fini);
+
+// Parse a comma separated list of event names and put each event on a
+// counter of its own, fixed counters first. There is no multiplexing here:
+// per-thread values have to be exact across switches.
+static int pmu_thread_setup(const char *names)
+{
+	char buf[PMU_THREAD_MAX_NAMES];
+	__u32 fixed_used = 0;
+	unsigned int counter = 0;
+
+	if (strlen(names) >= sizeof(buf))
+		return -1;
+	strcpy(buf, names);
+
+	pmu_thread_nr_events = 0;
+	for (char *name = buf, *end; name != NULL; name = end) {
+		end = strchr(name, ',');
+		if (end != NULL)
+			*end++ = '\0';
+		if (*name == '\0')
+			continue;
+
+		const struct pmu_event *event = pmu_event_find(name);
+		if (event == NULL) {
+			printf("unknown event %s\n", name);
+			goto err;
+		}
+		if (pmu_thread_nr_events == PMU_THREAD_MAX_EVENTS)
+			goto err;
+
+		unsigned int i = pmu_thread_nr_events++;
+		pmu_thread_events[i] = event;
+		if (event->fixed >= 0 && event->fixed < pmu_num_fixed_counters()
+		    && !(fixed_used & (1 << event->fixed))) {
+			fixed_used |= 1 << event->fixed;
+			pmu_fixed_enable(event->fixed);
+			pmu_thread_rdpmc[i] = PMU_RDPMC_FIXED | event->fixed;
+			pmu_thread_mask[i] = pmu_counter_width_mask(1);
+			continue;
+		}
+		if (event->event == PMU_EVENT_FIXED_ONLY) {
+			printf("%s needs fixed counter %d\n", name,
+			       event->fixed);
+			goto err;
+		}
+		if (pmu_counter_enable(counter, event->event, event->umask)
+		    < 0) {
+			printf("not enough counters for %s (%d general)\n",
+			       name, pmu_num_counters());
+			goto err;
+		}
+		pmu_thread_rdpmc[i] = counter++;
+		pmu_thread_mask[i] = pmu_counter_width_mask(0);
+	}
+	return pmu_thread_nr_events > 0 ? 0 : -1;
+
+err:
+	// don't leave the counters programmed so far running
+	for (unsigned int idx = 0; idx < PMU_MAX_FIXED_COUNTERS; idx++)
+		if (fixed_used & (1 << idx))
+			pmu_fixed_disable(idx);
+	while (counter > 0)
+		pmu_counter_disable(--counter);
+	pmu_thread_nr_events = 0;
+	return -1;
+}
+
+int pmu_thread_start(const char *events)
+{
+	struct uk_sched *sched;
+
+	if (pmu_thread_sched != NULL)
+		return 0;
+	if (pmu_init() < 0)
+		return -1;
+	sched = uk_sched_get_default();
+	if (sched == NULL)
+		return -1;
+	if (pmu_thread_setup(events ? events : PMU_THREAD_DEFAULT_EVENTS) < 0)
+		return -1;
+
+	memset(pmu_threads, 0, sizeof(pmu_threads));
+	pmu_thread_lost = 0;
+	pmu_thread_account(NULL);
+	pmu_thread_switch_orig = sched->plat_ctx_cbs.switch_cb;
+	sched->plat_ctx_cbs.switch_cb = pmu_thread_switch;
+	pmu_thread_sched = sched;
+	pmu_thread_slot(uk_thread_current(), 1);
+	return 0;
+}
+
+void pmu_thread_stop(void)
+{
+	if (pmu_thread_sched == NULL)
+		return;
+
+	pmu_thread_account(pmu_thread_slot(uk_thread_current(), 1));
+	pmu_thread_sched->plat_ctx_cbs.switch_cb = pmu_thread_switch_orig;
+	pmu_thread_sched = NULL;
+}
+
+// Counts of a thread, including what the calling thread has done since it
+// was last switched in.
+int pmu_thread_read(struct uk_thread *thread, struct pmu_thread_counts *counts)
+{
+	struct pmu_thread_slot *slot = pmu_thread_slot(thread, 0);
+
+	if (slot == NULL)
+		return -1;
+	if (pmu_thread_sched != NULL && thread == uk_thread_current())
+		pmu_thread_account(slot);
+	*counts = slot->counts;
+	return 0;
+}
+
+static int pmu_thread_event_index(const char *name)
+{
+	for (unsigned int i = 0; i < pmu_thread_nr_events; i++) {
+		if (strcmp(pmu_thread_events[i]->name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void pmu_thread_print(void)
+{
+	int instructions = pmu_thread_event_index("instructions");
+	int cycles = pmu_thread_event_index("cycles");
+
+	if (pmu_thread_nr_events == 0) {
+		printf("per-thread counters are not running\n");
+		return;
+	}
+	// bring the calling thread up to date
+	if (pmu_thread_sched != NULL)
+		pmu_thread_account(pmu_thread_slot(uk_thread_current(), 1));
+
+	printf("%-20s", "thread");
+	for (unsigned int i = 0; i < pmu_thread_nr_events; i++)
+		printf(" %16s", pmu_thread_events[i]->name);
+	printf(" %10s%s\n", "switches",
+	       instructions >= 0 && cycles >= 0 ? "     IPC" : "");
+
+	for (unsigned int i = 0; i < PMU_THREAD_MAX; i++) {
+		struct pmu_thread_slot *slot = &pmu_threads[i];
+
+		if (!slot->used)
+			continue;
+		printf("%-20s", slot->name);
+		for (unsigned int j = 0; j < pmu_thread_nr_events; j++)
+			printf(" %16lu", (unsigned long)slot->counts.count[j]);
+		printf(" %10lu", (unsigned long)slot->counts.switches);
+		if (instructions >= 0 && cycles >= 0
+		    && slot->counts.count[cycles] > 0) {
+			__u64 ipc100 = slot->counts.count[instructions] * 100
+				       / slot->counts.count[cycles];
+			printf(" %4lu.%02lu", (unsigned long)(ipc100 / 100),
+			       (unsigned long)(ipc100 % 100));
+		}
+		printf("%s\n", slot->thread == NULL ? " (exited)" : "");
+	}
+	if (pmu_thread_lost > 0)
+		printf("%lu switches of threads without a slot (max %d)\n",
+		       (unsigned long)pmu_thread_lost, PMU_THREAD_MAX);
+}
@@ -155,6 +155,10 @@ struct ebpf_inst
 #define EBPF_OP_JSGE_REG (EBPF_CLS_JMP | EBPF_SRC_REG | EBPF_MODE_JSGE)
 #define EBPF_OP_CALL (EBPF_CLS_JMP | EBPF_MODE_CALL)
 #define EBPF_OP_EXIT (EBPF_CLS_JMP | EBPF_MODE_EXIT)
+
+/* Values of the src field of EBPF_OP_CALL */
+#define EBPF_CALL_HELPER 0
+#define EBPF_CALL_LOCAL 1 /* imm is the pc-relative offset of a BPF function */
 #define EBPF_OP_JLT_IMM (EBPF_CLS_JMP | EBPF_SRC_IMM | EBPF_MODE_JLT)
 #define EBPF_OP_JLT_REG (EBPF_CLS_JMP | EBPF_SRC_REG | EBPF_MODE_JLT)
 #define EBPF_OP_JLE_IMM (EBPF_CLS_JMP | EBPF_SRC_IMM | EBPF_MODE_JLE)
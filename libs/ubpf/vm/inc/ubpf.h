@@ -42,6 +42,30 @@ extern "C" {
 #define UBPF_STACK_SIZE 512
 #endif
 
+/**
+ * @brief Default maximum depth of nested BPF-to-BPF calls, counting the entry
+ * function. Each level gets its own UBPF_STACK_SIZE stack frame, and a
+ * program only reserves the levels it can reach (all of them if it makes tail
+ * calls).
+ */
+#if !defined(UBPF_MAX_CALL_DEPTH)
+#define UBPF_MAX_CALL_DEPTH 8
+#endif
+
+/**
+ * @brief Default maximum number of tail calls chained by a single execution.
+ */
+#if !defined(UBPF_MAX_TAIL_CALLS)
+#define UBPF_MAX_TAIL_CALLS 32
+#endif
+
+/**
+ * @brief Default instruction budget of a single execution, see ubpf_set_instruction_budget().
+ */
+#if !defined(UBPF_DEFAULT_INSTRUCTION_BUDGET)
+#define UBPF_DEFAULT_INSTRUCTION_BUDGET 1000000
+#endif
+
 /**
  * @brief Opaque type for a the uBPF VM.
  */
@@ -70,6 +94,9 @@ ubpf_destroy(struct ubpf_vm* vm);
 
 /**
  * @brief Enable / disable bounds_check. Bounds check is enabled by default, but it may be too restrictive.
+ * The setting applies to the interpreter and to code jitted afterwards by the
+ * x86-64 JIT, where out of bounds accesses make the program return -1. The
+ * arm64 JIT does not check accesses.
  *
  * @param[in] vm The VM to enable / disable bounds check on.
  * @param[in] enable Enable bounds check if true, disable if false.
@@ -182,6 +209,23 @@ ubpf_load_elf(struct ubpf_vm* vm, const void* elf, size_t elf_len, char** errmsg
 int
 ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_return_value);
 
+/**
+ * @brief Execute a BPF program in the VM using the interpreter and count the instructions it executed.
+ *
+ * Same as ubpf_exec(), instructions of tail called programs are included in the count.
+ *
+ * @param[in] vm The VM to execute the program in.
+ * @param[in] mem The memory to pass to the program.
+ * @param[in] mem_len The length of the memory.
+ * @param[in] bpf_return_value The value of the r0 register when the program exits.
+ * @param[out] instruction_count The number of instructions executed, also set on failure.
+ * @retval 0 Success.
+ * @retval -1 Failure.
+ */
+int
+ubpf_exec_count(
+    const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_return_value, uint32_t* instruction_count);
+
 /**
  * @brief Compile a BPF program in the VM to native code.
  *
@@ -195,6 +239,23 @@ ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_ret
 ubpf_jit_fn
 ubpf_compile(struct ubpf_vm* vm, char** errmsg);
 
+/**
+ * @brief Execute the BPF program compiled by ubpf_compile().
+ *
+ * Unlike calling the ubpf_jit_fn, which returns -1 on an out of bounds access
+ * or when the instruction budget runs out, this tells such faults apart from
+ * a program returning -1.
+ *
+ * @param[in] vm The VM to execute the program in.
+ * @param[in] mem The memory to pass to the program.
+ * @param[in] mem_len The length of the memory.
+ * @param[in] bpf_return_value The value of the r0 register when the program exits.
+ * @retval 0 Success.
+ * @retval -1 The program faulted or has not been compiled.
+ */
+int
+ubpf_exec_jit(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_return_value);
+
 /*
  * Translate the eBPF byte code to x64 machine code, store in buffer, and
  * write the resulting count of bytes to size.
@@ -221,6 +282,23 @@ ubpf_compile(struct ubpf_vm* vm, char** errmsg);
 int
 ubpf_translate(struct ubpf_vm* vm, uint8_t* buffer, size_t* size, char** errmsg);
 
+/**
+ * @brief Set the instruction budget of a single execution, which stops runaway
+ * programs. The interpreter counts every executed instruction. Jitted code
+ * only keeps count on backward jumps, each charging the length of the loop
+ * body it closes. A program exhausting its budget is aborted and returns -1.
+ * Programs reached by tail calls share the budget of the first one. The
+ * setting applies to code jitted afterwards by the x86-64 JIT, the arm64 JIT
+ * ignores it.
+ *
+ * @param[in] vm The VM to set the budget on.
+ * @param[in] budget Maximum number of instructions (at most INT32_MAX), or 0 for no limit.
+ * @retval 0 Success.
+ * @retval -1 Failure.
+ */
+int
+ubpf_set_instruction_budget(struct ubpf_vm* vm, uint32_t budget);
+
 /**
  * @brief Instruct the uBPF runtime to apply unwind-on-success semantics to a helper function.
  * If the function returns 0, the uBPF runtime will end execution of
@@ -235,6 +313,43 @@ ubpf_translate(struct ubpf_vm* vm, uint8_t* buffer, size_t* size, char** errmsg)
 int
 ubpf_set_unwind_function_index(struct ubpf_vm* vm, unsigned int idx);
 
+/**
+ * @brief Instruct the uBPF runtime to treat a helper function as a tail call.
+ * The helper receives the usual helper arguments and returns a pointer to the
+ * loaded struct ubpf_vm to continue in, or 0 if there is none. On success the
+ * current program is replaced by the entry of the returned one, with r1
+ * preserved and a fresh stack; control never returns to the caller program.
+ * On failure (no program, or more than UBPF_MAX_TAIL_CALLS chained calls) r0
+ * is set to -1 and execution continues after the call.
+ *
+ * A program reached by a tail call from jitted code must be jitted as well,
+ * and must stay loaded while it can be the target of a tail call: the caller
+ * has to defer ubpf_destroy() of a replaced program until the runs that could
+ * still reach it have ended (see bpf_prog_array_retire() in ubpf_tracer).
+ *
+ * @param[in] vm The VM to set the tail call helper in.
+ * @param[in] idx Index of the helper function acting as tail call.
+ * @retval 0 Success.
+ * @retval -1 Failure.
+ */
+int
+ubpf_set_tail_call_function_index(struct ubpf_vm* vm, unsigned int idx);
+
+/**
+ * @brief Set a function that is told where the BPF stack of each execution is.
+ * It is called before the first instruction runs, with the lowest address and
+ * the size of the stack (the frames of all call levels it reserves). Helpers that take pointers into
+ * the BPF stack can use it to check them. Programs reached by tail calls reuse
+ * the stack of the first one. Only the interpreter and the x86-64 JIT call
+ * it, the arm64 JIT refuses to compile a VM that has one.
+ *
+ * @param[in] vm The VM to set the stack hook in.
+ * @param[in] hook The function to call, or NULL.
+ * @retval 0 Success.
+ */
+int
+ubpf_set_stack_hook(struct ubpf_vm* vm, void (*hook)(void* stack, size_t size));
+
 /**
  * @brief Override the storage location for the BPF registers in the VM.
  *
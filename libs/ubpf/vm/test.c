@@ -26,6 +26,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <math.h>
 #include "ubpf.h"
 
@@ -44,7 +45,8 @@ static void
 usage(const char* name)
 {
     fprintf(stderr, "usage: %s [-h] [-j|--jit] [-m|--mem PATH] BINARY\n", name);
-    fprintf(stderr, "\nExecutes the eBPF code in BINARY and prints the result to stdout.\n");
+    fprintf(stderr, "\nExecutes the eBPF code in BINARY and prints the result to stdout,\n");
+    fprintf(stderr, "or \"error\" if it faulted.\n");
     fprintf(
         stderr, "If --mem is given then the specified file will be read and a pointer\nto its data passed in r1.\n");
     fprintf(stderr, "If --jit is given then the JIT compiler will be used.\n");
@@ -192,13 +194,16 @@ load:
             free(mem);
             return 1;
         }
-        ret = fn(mem, mem_len);
+        rv = ubpf_exec_jit(vm, mem, mem_len, &ret);
     } else {
-        if (ubpf_exec(vm, mem, mem_len, &ret) < 0)
-            ret = UINT64_MAX;
+        rv = ubpf_exec(vm, mem, mem_len, &ret);
     }
 
-    printf("0x%" PRIx64 "\n", ret);
+    /* Faults are reported apart from a program returning -1 */
+    if (rv < 0)
+        printf("error\n");
+    else
+        printf("0x%" PRIx64 "\n", ret);
 
     ubpf_destroy(vm);
     free(mem);
@@ -221,11 +226,39 @@ readfile(const char* path, size_t maxlen, size_t* len)
         return NULL;
     }
 
-    char* data = calloc(maxlen, 1);
+    /*
+     * Size the buffer after the file rather than allocating maxlen up front.
+     * The extra byte lets a regular file end in a short read; pipes start
+     * small and grow, capped at one byte past maxlen to detect overflow.
+     */
+    struct stat st;
+    size_t capacity = 4096;
+    if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)) {
+        capacity = (size_t)st.st_size + 1;
+    }
+    if (capacity > maxlen + 1) {
+        capacity = maxlen + 1;
+    }
+
+    char* data = malloc(capacity);
     size_t offset = 0;
-    size_t rv;
-    while ((rv = fread(data + offset, 1, maxlen - offset, file)) > 0) {
-        offset += rv;
+    while (data != NULL) {
+        offset += fread(data + offset, 1, capacity - offset, file);
+        if (offset < capacity || offset > maxlen) {
+            break;
+        }
+        capacity = capacity * 2 > maxlen + 1 ? maxlen + 1 : capacity * 2;
+        char* grown = realloc(data, capacity);
+        if (grown == NULL) {
+            free(data);
+        }
+        data = grown;
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate memory for %s\n", path);
+        fclose(file);
+        return NULL;
     }
 
     if (ferror(file)) {
@@ -235,7 +268,7 @@ readfile(const char* path, size_t maxlen, size_t* len)
         return NULL;
     }
 
-    if (!feof(file)) {
+    if (offset > maxlen) {
         fprintf(stderr, "Failed to read %s because it is too large (max %u bytes)\n", path, (unsigned)maxlen);
         fclose(file);
         free(data);
@@ -316,6 +349,19 @@ unwind(uint64_t i)
     return i;
 }
 
+/*
+ * Program array of the tail call helper: slot 0 is the program under test
+ * itself, every other slot is empty.
+ */
+static struct ubpf_vm* tail_call_self;
+
+static uint64_t
+tail_call(uint64_t ctx, uint64_t index)
+{
+    (void)ctx;
+    return index == 0 ? (uint64_t)(uintptr_t)tail_call_self : 0;
+}
+
 static void
 register_functions(struct ubpf_vm* vm)
 {
@@ -326,4 +372,7 @@ register_functions(struct ubpf_vm* vm)
     ubpf_register(vm, 4, "strcmp_ext", strcmp);
     ubpf_register(vm, 5, "unwind", unwind);
     ubpf_set_unwind_function_index(vm, 5);
+    ubpf_register(vm, 6, "tail_call", tail_call);
+    ubpf_set_tail_call_function_index(vm, 6);
+    tail_call_self = vm;
 }
@@ -0,0 +1,10 @@
+# 32-bit ALU operations zero the upper half of the destination
+# result: 0x80000001
+	r0 = -1 ll
+	w0 = 0x7fffffff
+	w1 = 2
+	w0 += w1		# wraps to 0x80000001
+	w1 *= w1		# 4
+	w1 >>= 2		# 1
+	w0 |= w1
+	exit
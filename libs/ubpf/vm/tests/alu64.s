@@ -0,0 +1,17 @@
+# 64-bit ALU operations
+# result: 0xfffffffff6555510
+	r0 = 7
+	r1 = 3
+	r0 *= r1		# 21
+	r0 += 0x7fffffff	# 0x80000014
+	r0 /= r1		# 0x2aaaaab1
+	r0 <<= 40		# 0xaaaab10000000000
+	r0 >>= 36		# 0xaaaab10
+	r2 = -256
+	r2 s>>= 4		# -16
+	r2 ^= -1		# 15
+	r0 |= r2		# 0xaaaab1f
+	r0 ^= 0xff		# 0xaaaabe0
+	r0 -= 0x10000f0		# 0x9aaaaf0
+	r0 = -r0
+	exit
@@ -0,0 +1,9 @@
+# an out of bounds load faults in the interpreter and in the JIT, apart from
+# the -1 already in r0
+# jit: x86_64
+# result: error
+	r0 = -1
+	r1 = r10
+	r1 += 8
+	r2 = *(u64 *)(r1 + 0)	# above the stack, in the JIT's scratch slots
+	exit
@@ -0,0 +1,7 @@
+# an endless loop runs out of the default budget of 1000000 instructions
+# jit: x86_64
+# result: error
+	r0 = 0
+loop:
+	r0 += 1
+	goto loop
@@ -0,0 +1,23 @@
+# backward jumps are only charged when taken: 200000 iterations of the loop
+# take 600000 instructions, within the default budget, while charging the
+# long jump that is never taken would take more than 2000000
+# jit: x86_64
+# result: 0x30d40
+	r0 = 0
+	goto loop
+far:
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+	r0 += 1
+loop:
+	r0 += 1
+	if r0 == 0 goto far
+	if r0 < 200000 goto loop
+	exit
@@ -0,0 +1,9 @@
+# helper calls get r1-r5, r0 is their result
+# result: 0x102030405
+	r1 = 1
+	r2 = 2
+	r3 = 3
+	r4 = 4
+	r5 = 5
+	call 0			# gather_bytes
+	exit
@@ -0,0 +1,31 @@
+# signed and unsigned conditional jumps
+# result: 0x3f
+	r0 = 0
+	r1 = -1
+	r2 = 1
+	if r1 > r2 goto l1	# unsigned: taken
+	exit
+l1:
+	r0 |= 1
+	if r1 s> r2 goto out	# signed: not taken
+	r0 |= 2
+	if r1 s< 0 goto l2
+	exit
+l2:
+	r0 |= 4
+	if r2 >= 1 goto l3
+	exit
+l3:
+	r0 |= 8
+	w1 = -1
+	r3 = 0xffffffff ll
+	if r1 == r3 goto l4	# 32-bit move cleared the upper half
+	exit
+l4:
+	r0 |= 16
+	if r2 <= 1 goto l5
+	exit
+l5:
+	r0 |= 32
+out:
+	exit
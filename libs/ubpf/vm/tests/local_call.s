@@ -0,0 +1,26 @@
+# BPF-to-BPF calls: r6-r9 and the caller's stack frame are preserved
+# jit: x86_64
+# result: 0x30
+	r6 = 5
+	r1 = 7
+	*(u64 *)(r10 - 8) = r1
+	r1 = 3
+	call twice_plus		# 12
+	r1 = *(u64 *)(r10 - 8)
+	r0 += r1		# 19
+	r0 += r6		# 24
+	r0 += r0
+	exit
+twice_plus:
+	r6 = r1
+	*(u64 *)(r10 - 8) = r6	# own frame, the caller's value stays
+	call twice		# 6
+	r0 += r6		# 9
+	r1 = *(u64 *)(r10 - 8)
+	r0 += r1		# 12
+	exit
+twice:
+	r6 = 100
+	r0 = r1
+	r0 += r1
+	exit
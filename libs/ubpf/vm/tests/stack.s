@@ -0,0 +1,28 @@
+# stack stores and loads of every size, and byte swaps
+# result: 0x12345678aabbccdd
+	r1 = 0x1122334455667788 ll
+	*(u64 *)(r10 - 8) = r1
+	r2 = 0xaabb
+	*(u16 *)(r10 - 8) = r2
+	r2 = 0xccdd
+	*(u16 *)(r10 - 6) = r2
+	r2 = 0x12345678
+	*(u32 *)(r10 - 4) = r2
+	r0 = *(u64 *)(r10 - 8)	# 0x12345678ccddaabb
+	r0 >>= 32
+	r0 <<= 32		# 0x1234567800000000
+	r3 = *(u8 *)(r10 - 8)	# 0xbb
+	r3 = be16 r3		# 0xbb00
+	r3 >>= 8
+	r4 = *(u32 *)(r10 - 8)	# 0xccddaabb
+	r4 = be32 r4		# 0xbbaaddcc
+	r5 = r4
+	r5 = be16 r5		# 0xccdd
+	r4 >>= 16
+	r4 = be16 r4		# 0xaabb
+	r4 -= r3		# 0xaa00
+	r4 += 0xbb
+	r4 <<= 16
+	r0 |= r4
+	r0 |= r5
+	exit
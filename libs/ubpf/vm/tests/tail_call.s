@@ -0,0 +1,21 @@
+# tail calls: an empty slot returns -1 and continues, r1 is kept, chains stop
+# after UBPF_MAX_TAIL_CALLS (32) calls. Slot 0 of test.c's program array is
+# the program itself.
+# jit: x86_64
+# result: 0x21
+	if r1 != 0 goto count
+	r2 = 1
+	call 6			# empty slot
+	if r0 == -1 goto start
+	r0 = 0xbad
+	exit
+start:
+	r1 = 0
+count:
+	r6 = r1
+	r6 += 1
+	r1 = r6
+	r2 = 0
+	call 6			# only returns once the chain is too long
+	r0 = r6
+	exit
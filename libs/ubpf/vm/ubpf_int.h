@@ -21,7 +21,12 @@
 #include <ubpf.h>
 #include "ebpf.h"
 
+/* Stack of a program using every call level: one UBPF_STACK_SIZE frame each */
+#define UBPF_TOTAL_STACK_SIZE (UBPF_STACK_SIZE * UBPF_MAX_CALL_DEPTH)
+
 struct ebpf_inst;
+/* Jitted entry that sets *fault on an out of bounds access or budget abort */
+typedef uint64_t (*ubpf_jit_fault_fn)(void* mem, size_t mem_len, int* fault);
 typedef uint64_t (*ext_func)(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4);
 
 struct ubpf_vm
@@ -33,9 +38,17 @@ struct ubpf_vm
     ext_func* ext_funcs;
     const char** ext_func_names;
     bool bounds_check_enabled;
+    uint32_t instruction_budget;
     int (*error_printf)(FILE* stream, const char* format, ...);
     int (*translate)(struct ubpf_vm* vm, uint8_t* buffer, size_t* size, char** errmsg);
     int unwind_stack_extension_index;
+    int tail_call_extension_index;
+    void (*stack_hook)(void* stack, size_t size);
+    uint32_t stack_size; /* UBPF_STACK_SIZE per call level, set by ubpf_load() */
+    size_t tail_call_entry_offset;
+    void* jitted_tail_call_entry;
+    size_t fault_entry_offset;
+    void* jitted_fault_entry; /* ubpf_jit_fault_fn, used by ubpf_exec_jit() */
     uint64_t pointer_secret;
 #ifdef DEBUG
     uint64_t* regs;
@@ -52,6 +65,10 @@ ubpf_translate_null(struct ubpf_vm* vm, uint8_t* buffer, size_t* size, char** er
 
 char*
 ubpf_error(const char* fmt, ...);
+void
+ubpf_jit_bounds_error(const struct ubpf_vm* vm, uint64_t pc);
+void
+ubpf_jit_budget_exhausted(const struct ubpf_vm* vm);
 unsigned int
 ubpf_lookup_registered_function(struct ubpf_vm* vm, const char* name);
 
@@ -67,6 +67,8 @@ ubpf_compile(struct ubpf_vm* vm, char** errmsg)
 
     jitted_size = 65536;
     buffer = calloc(jitted_size, 1);
+    vm->tail_call_entry_offset = 0;
+    vm->fault_entry_offset = 0;
 
     if (ubpf_translate(vm, buffer, &jitted_size, errmsg) < 0) {
         goto out;
@@ -85,8 +87,15 @@ ubpf_compile(struct ubpf_vm* vm, char** errmsg)
         goto out;
     }
 
+#if defined(__aarch64__)
+    /* The instruction cache is not coherent with the data writes above */
+    __builtin___clear_cache((char*)jitted, (char*)jitted + jitted_size);
+#endif
+
     vm->jitted = jitted;
     vm->jitted_size = jitted_size;
+    vm->jitted_tail_call_entry = vm->tail_call_entry_offset ? (uint8_t*)jitted + vm->tail_call_entry_offset : NULL;
+    vm->jitted_fault_entry = vm->fault_entry_offset ? (uint8_t*)jitted + vm->fault_entry_offset : NULL;
 
 out:
     free(buffer);
@@ -95,3 +104,19 @@ out:
     }
     return vm->jitted;
 }
+
+int
+ubpf_exec_jit(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_return_value)
+{
+    int fault = 0;
+
+    if (vm->jitted_fault_entry) {
+        *bpf_return_value = ((ubpf_jit_fault_fn)vm->jitted_fault_entry)(mem, mem_len, &fault);
+    } else if (vm->jitted) {
+        /* Targets without an entry for it have no checks that can fail */
+        *bpf_return_value = vm->jitted(mem, mem_len);
+    } else {
+        return -1;
+    }
+    return fault ? -1 : 0;
+}
@@ -867,6 +867,11 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
 {
     int i;
 
+    if (vm->stack_hook) {
+        *errmsg = ubpf_error("stack hooks are not supported by the arm64 JIT");
+        return -1;
+    }
+
     emit_function_prologue(state, UBPF_STACK_SIZE);
 
     for (i = 0; i < vm->num_insts; i++) {
@@ -1017,6 +1022,10 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
             emit_conditionalbranch_immediate(state, to_condition(opcode), target_pc);
             break;
         case EBPF_OP_CALL:
+            if (inst.src == EBPF_CALL_LOCAL || inst.imm == vm->tail_call_extension_index) {
+                *errmsg = ubpf_error("BPF-to-BPF and tail calls are not supported by the arm64 JIT (PC %d)", i);
+                return -1;
+            }
             emit_call(state, (uintptr_t)vm->ext_funcs[inst.imm]);
             if (inst.imm == vm->unwind_stack_extension_index) {
                 emit_addsub_immediate(state, true, AS_SUBS, RZ, map_register(0), 0);
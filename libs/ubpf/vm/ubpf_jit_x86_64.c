@@ -24,6 +24,7 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <assert.h>
+#include <stddef.h>
 #include "ubpf_int.h"
 #include "ubpf_jit_x86_64.h"
 
@@ -34,6 +35,8 @@
 /* Special values for target_pc in struct jump */
 #define TARGET_PC_EXIT -1
 #define TARGET_PC_DIV_BY_ZERO -2
+#define TARGET_PC_BOUNDS_ERROR -3
+#define TARGET_PC_BUDGET_EXHAUSTED -4
 
 static void
 muldivmod(struct jit_state* state, uint8_t opcode, int src, int dst, int32_t imm);
@@ -70,7 +73,7 @@ static int register_map[REGISTER_MAP_SIZE] = {
 };
 #else
 #define RCX_ALT R9
-static int platform_nonvolatile_registers[] = {RBP, RBX, R13, R14, R15};
+static int platform_nonvolatile_registers[] = {RBP, RBX, R12, R13, R14, R15};
 static int platform_parameter_registers[] = {RDI, RSI, RDX, RCX, R8, R9};
 static int register_map[REGISTER_MAP_SIZE] = {
     RAX,
@@ -87,6 +90,27 @@ static int register_map[REGISTER_MAP_SIZE] = {
 };
 #endif
 
+/*
+ * Top of the BPF stack. The scratch slots lie above it and the BPF stack
+ * frames of all call levels below it, so the epilogue can unwind any number of
+ * nested BPF-to-BPF calls by restoring RSP from it.
+ */
+#define FRAME_BASE R12
+
+/*
+ * 8-byte scratch slots above the BPF stack, addressed from FRAME_BASE. Their
+ * place does not depend on the stack size of the program, as the programs it
+ * tail calls use them too.
+ */
+#define SCRATCH_SLOT_TAIL_CALL_COUNT 0
+#define SCRATCH_SLOT_CTX_START 1
+#define SCRATCH_SLOT_CTX_LEN 2
+#define SCRATCH_SLOT_BUDGET 3
+#define SCRATCH_SLOT_FAULT 4
+#define NUM_SCRATCH_SLOTS 5
+#define SCRATCH_SIZE (NUM_SCRATCH_SLOTS * (int32_t)sizeof(uint64_t))
+#define SCRATCH_SLOT_OFFSET(slot) ((int32_t)sizeof(uint64_t) * (slot))
+
 /* Return the x86 register for the given eBPF register */
 static int
 map_register(int r)
@@ -118,26 +142,252 @@ ubpf_set_register_offset(int x)
     }
 }
 
+/*
+ * Size of the native stack allocated below FRAME_BASE: the BPF stack of the
+ * program, padded so that RSP stays 16-byte aligned at helper calls.
+ */
+static int32_t
+native_stack_size(const struct ubpf_vm* vm)
+{
+#if defined(_WIN32)
+    /* emit_call spills one parameter and allocates home space */
+    int32_t call_overhead = 5 * sizeof(uint64_t);
+#else
+    int32_t call_overhead = 0;
+#endif
+    /* Return address, saved non-volatile registers and scratch slots */
+    int32_t used = (1 + _countof(platform_nonvolatile_registers)) * sizeof(uint64_t) + SCRATCH_SIZE + call_overhead;
+    int32_t size = vm->stack_size;
+    return size + (16 - (used + size) % 16) % 16;
+}
+
+/*
+ * BPF-to-BPF call. r6-r9 are preserved for the caller and r10 moves down to
+ * the callee's stack frame. ubpf_load() sizes the stack for the deepest
+ * nesting validate() found, so the frames always fit.
+ */
+static void
+emit_local_call(struct jit_state* state, uint32_t target_pc)
+{
+    int r;
+    for (r = 6; r <= 9; r++) {
+        emit_push(state, map_register(r));
+    }
+    emit_alu64_imm32(state, 0x81, 5, map_register(10), UBPF_STACK_SIZE);
+    /* Keep RSP 16-byte aligned in the callee */
+    emit_alu64_imm32(state, 0x81, 5, RSP, sizeof(uint64_t));
+    emit1(state, 0xe8); /* call rel32 */
+    emit_jump_offset(state, target_pc);
+    emit_alu64_imm32(state, 0x81, 0, RSP, sizeof(uint64_t));
+    emit_alu64_imm32(state, 0x81, 0, map_register(10), UBPF_STACK_SIZE);
+    for (r = 9; r >= 6; r--) {
+        emit_pop(state, map_register(r));
+    }
+}
+
+/*
+ * Tail call: ask the helper for the next program and jump to its tail call
+ * entry with r1 preserved and the stack reset. If there is no (jitted)
+ * program or the chain is too long, r0 is -1 and execution continues at
+ * next_pc. The next program runs in this frame, which ubpf_load() sizes for
+ * every call level when the program makes tail calls.
+ */
+static void
+emit_tail_call(struct ubpf_vm* vm, struct jit_state* state, uint32_t next_pc)
+{
+    int32_t count_offset = SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_TAIL_CALL_COUNT);
+
+    /* Keep the context pointer for the next program, twice for alignment */
+    emit_push(state, map_register(1));
+    emit_push(state, map_register(1));
+    /* We reserve RCX for shifts */
+    emit_mov(state, RCX_ALT, RCX);
+    emit_call(state, vm->ext_funcs[vm->tail_call_extension_index]);
+    emit_mov(state, RAX, RCX);
+    emit_pop(state, map_register(1));
+    emit_pop(state, map_register(1));
+
+    emit_load_imm(state, map_register(0), -1);
+    emit_alu64(state, 0x85, RCX, RCX);
+    emit_jcc(state, 0x84, next_pc);
+
+    /* cmpq $UBPF_MAX_TAIL_CALLS, count(FRAME_BASE) */
+    emit_basic_rex(state, 1, 0, FRAME_BASE);
+    emit1(state, 0x81);
+    emit_modrm_and_displacement(state, 7, FRAME_BASE, count_offset);
+    emit4(state, UBPF_MAX_TAIL_CALLS);
+    emit_jcc(state, 0x83, next_pc);
+
+    emit_load(state, S64, RCX, RCX, offsetof(struct ubpf_vm, jitted_tail_call_entry));
+    emit_alu64(state, 0x85, RCX, RCX);
+    emit_jcc(state, 0x84, next_pc);
+
+    /* incq count(FRAME_BASE) */
+    emit_basic_rex(state, 1, 0, FRAME_BASE);
+    emit1(state, 0xff);
+    emit_modrm_and_displacement(state, 0, FRAME_BASE, count_offset);
+
+    /* Drop all frames of this program */
+    emit_mov(state, FRAME_BASE, map_register(10));
+    emit_mov(state, FRAME_BASE, RSP);
+    emit_alu64_imm32(state, 0x81, 5, RSP, native_stack_size(vm));
+
+    /* jmp *%rcx */
+    emit1(state, 0xff);
+    emit1(state, 0xe1);
+}
+
+/*
+ * Check that [reg + offset, reg + offset + size) lies within the BPF stack or
+ * the context, as bounds_check() does in the interpreter. Out of bounds
+ * accesses jump to the bounds error stub with the PC in RCX.
+ */
+static void
+emit_bounds_check(const struct ubpf_vm* vm, struct jit_state* state, int reg, int32_t offset, int size, int pc)
+{
+    /* r10 is read-only: accesses within its frame need no check */
+    if (reg == 10 && offset >= -UBPF_STACK_SIZE && offset + size <= 0) {
+        return;
+    }
+    int base = map_register(reg);
+
+    /* Stack: addr - (FRAME_BASE - stack_size) <= stack_size - size */
+    emit_basic_rex(state, 1, RCX, base);
+    emit1(state, 0x8d); /* lea */
+    emit_modrm_and_displacement(state, RCX, base, offset);
+    emit_alu64(state, 0x29, FRAME_BASE, RCX);
+    emit_alu64_imm32(state, 0x81, 0, RCX, vm->stack_size);
+    emit_cmp_imm32(state, RCX, vm->stack_size - size);
+    uint32_t stack_ok = emit_short_jcc(state, 0x76); /* jbe */
+
+    /* Context: addr - mem + size <= mem_len, without wrapping around */
+    emit_basic_rex(state, 1, RCX, base);
+    emit1(state, 0x8d); /* lea */
+    emit_modrm_and_displacement(state, RCX, base, offset);
+    emit_basic_rex(state, 1, RCX, FRAME_BASE);
+    emit1(state, 0x2b); /* sub */
+    emit_modrm_and_displacement(state, RCX, FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_CTX_START));
+    emit_alu64_imm8(state, 0x83, 0, RCX, size);
+    uint32_t wrapped = emit_short_jcc(state, 0x72); /* jc */
+    emit_basic_rex(state, 1, RCX, FRAME_BASE);
+    emit1(state, 0x3b); /* cmp */
+    emit_modrm_and_displacement(state, RCX, FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_CTX_LEN));
+    uint32_t ctx_ok = emit_short_jcc(state, 0x76); /* jbe */
+
+    patch_short_jump(state, wrapped);
+    emit_load_imm(state, RCX, pc);
+    emit_jmp(state, TARGET_PC_BOUNDS_ERROR);
+
+    patch_short_jump(state, stack_ok);
+    patch_short_jump(state, ctx_ok);
+}
+
+/* Take len instructions from the budget, aborting once it runs out */
+static void
+emit_budget_charge(struct jit_state* state, int32_t len)
+{
+    /* subq $len, budget(FRAME_BASE) */
+    emit_basic_rex(state, 1, 0, FRAME_BASE);
+    emit1(state, 0x81);
+    emit_modrm_and_displacement(state, 5, FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_BUDGET));
+    emit4(state, len);
+    emit_jcc(state, 0x88, TARGET_PC_BUDGET_EXHAUSTED); /* js */
+}
+
+static bool
+is_jump(uint8_t opcode)
+{
+    uint8_t cls = opcode & EBPF_CLS_MASK;
+    return (cls == EBPF_CLS_JMP || cls == EBPF_CLS_JMP32) && opcode != EBPF_OP_CALL && opcode != EBPF_OP_EXIT;
+}
+
 static int
 translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
 {
     int i;
+    bool local_calls = false;
+    bool tail_calls = false;
+
+    for (i = 0; i < vm->num_insts; i++) {
+        struct ebpf_inst inst = ubpf_fetch_instruction(vm, i);
+        if (inst.opcode == EBPF_OP_CALL) {
+            if (inst.src == EBPF_CALL_LOCAL) {
+                local_calls = true;
+            } else if (inst.imm == vm->tail_call_extension_index) {
+                tail_calls = true;
+            }
+        }
+    }
+
+    /*
+     * ubpf_jit_fn entry: no fault flag. ubpf_exec_jit() enters right after
+     * this with a pointer to one in the third parameter.
+     */
+    emit_alu64(state, 0x31, platform_parameter_registers[2], platform_parameter_registers[2]);
+    vm->fault_entry_offset = state->offset;
 
     /* Save platform non-volatile registers */
     for (i = 0; i < _countof(platform_nonvolatile_registers); i++) {
         emit_push(state, platform_nonvolatile_registers[i]);
     }
+    emit_alu64_imm32(state, 0x81, 5, RSP, SCRATCH_SIZE);
+    emit_mov(state, RSP, FRAME_BASE);
+
+    /* Allocate stack space */
+    emit_alu64_imm32(state, 0x81, 5, RSP, native_stack_size(vm));
+
+    /* Kept for the programs this one tail calls as well */
+    emit_store(state, S64, platform_parameter_registers[2], FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_FAULT));
+
+    /* Tell the stack hook where the BPF stack is, keeping the parameters */
+    if (vm->stack_hook) {
+        emit_push(state, platform_parameter_registers[0]);
+        emit_push(state, platform_parameter_registers[1]);
+        /* lea -stack_size(FRAME_BASE), param0 */
+        emit_basic_rex(state, 1, platform_parameter_registers[0], FRAME_BASE);
+        emit1(state, 0x8d);
+        emit_modrm_and_displacement(state, platform_parameter_registers[0], FRAME_BASE, -(int32_t)vm->stack_size);
+        emit_load_imm(state, platform_parameter_registers[1], vm->stack_size);
+        emit_call(state, vm->stack_hook);
+        emit_pop(state, platform_parameter_registers[1]);
+        emit_pop(state, platform_parameter_registers[0]);
+    }
+
+    /*
+     * Remember the context for bounds checks. Always done, as programs
+     * entered by a tail call rely on it. A NULL context is empty.
+     */
+    emit_store(state, S64, platform_parameter_registers[0], FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_CTX_START));
+    emit_store(state, S64, platform_parameter_registers[1], FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_CTX_LEN));
+    emit_alu64(state, 0x85, platform_parameter_registers[0], platform_parameter_registers[0]);
+    uint32_t ctx_not_null = emit_short_jcc(state, 0x75); /* jnz */
+    emit_store_imm32(state, S64, FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_CTX_LEN), 0);
+    patch_short_jump(state, ctx_not_null);
+
+    /*
+     * Start the instruction budget, also for programs without loops as it
+     * is shared with the programs they tail call.
+     */
+    emit_store_imm32(
+        state,
+        S64,
+        FRAME_BASE,
+        SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_BUDGET),
+        vm->instruction_budget ? vm->instruction_budget : INT32_MAX);
 
     /* Move first platform parameter register into register 1 */
     if (map_register(1) != platform_parameter_registers[0]) {
         emit_mov(state, platform_parameter_registers[0], map_register(1));
     }
 
-    /* Copy stack pointer to R10 */
-    emit_mov(state, RSP, map_register(10));
+    /* Point R10 to the top of the stack */
+    emit_mov(state, FRAME_BASE, map_register(10));
 
-    /* Allocate stack space */
-    emit_alu64_imm32(state, 0x81, 5, RSP, UBPF_STACK_SIZE);
+    /* Only the program starting a tail call chain counts its length */
+    if (tail_calls) {
+        emit_store_imm32(state, S64, FRAME_BASE, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_TAIL_CALL_COUNT), 0);
+    }
+    vm->tail_call_entry_offset = state->offset;
 
     for (i = 0; i < vm->num_insts; i++) {
         struct ebpf_inst inst = ubpf_fetch_instruction(vm, i);
@@ -147,6 +397,16 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
         int src = map_register(inst.src);
         uint32_t target_pc = i + inst.offset + 1;
 
+        /*
+         * Charge backward jumps with the length of the loop they close, only
+         * when taken: conditional ones branch to the charge below instead.
+         */
+        bool charge = vm->instruction_budget && is_jump(inst.opcode) && inst.offset < 0;
+        int num_jumps = state->num_jumps;
+        if (charge && inst.opcode == EBPF_OP_JA) {
+            emit_budget_charge(state, i - target_pc + 1);
+        }
+
         switch (inst.opcode) {
         case EBPF_OP_ADD_IMM:
             emit_alu32_imm32(state, 0x81, 0, dst, inst.imm);
@@ -485,6 +745,14 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
             emit_jcc(state, 0x8e, target_pc);
             break;
         case EBPF_OP_CALL:
+            if (inst.src == EBPF_CALL_LOCAL) {
+                emit_local_call(state, i + inst.imm + 1);
+                break;
+            }
+            if (inst.imm == vm->tail_call_extension_index) {
+                emit_tail_call(vm, state, i + 1);
+                break;
+            }
             /* We reserve RCX for shifts */
             emit_mov(state, RCX_ALT, RCX);
             emit_call(state, vm->ext_funcs[inst.imm]);
@@ -494,47 +762,88 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
             }
             break;
         case EBPF_OP_EXIT:
-            if (i != vm->num_insts - 1) {
+            if (local_calls) {
+                /* Return to the calling BPF function unless in the outermost frame */
+                emit_cmp(state, FRAME_BASE, map_register(10));
+                emit_jcc(state, 0x84, TARGET_PC_EXIT);
+                emit1(state, 0xc3); /* ret */
+            } else if (i != vm->num_insts - 1) {
                 emit_jmp(state, TARGET_PC_EXIT);
             }
             break;
 
         case EBPF_OP_LDXW:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.src, inst.offset, 4, i);
+            }
             emit_load(state, S32, src, dst, inst.offset);
             break;
         case EBPF_OP_LDXH:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.src, inst.offset, 2, i);
+            }
             emit_load(state, S16, src, dst, inst.offset);
             break;
         case EBPF_OP_LDXB:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.src, inst.offset, 1, i);
+            }
             emit_load(state, S8, src, dst, inst.offset);
             break;
         case EBPF_OP_LDXDW:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.src, inst.offset, 8, i);
+            }
             emit_load(state, S64, src, dst, inst.offset);
             break;
 
         case EBPF_OP_STW:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 4, i);
+            }
             emit_store_imm32(state, S32, dst, inst.offset, inst.imm);
             break;
         case EBPF_OP_STH:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 2, i);
+            }
             emit_store_imm32(state, S16, dst, inst.offset, inst.imm);
             break;
         case EBPF_OP_STB:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 1, i);
+            }
             emit_store_imm32(state, S8, dst, inst.offset, inst.imm);
             break;
         case EBPF_OP_STDW:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 8, i);
+            }
             emit_store_imm32(state, S64, dst, inst.offset, inst.imm);
             break;
 
         case EBPF_OP_STXW:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 4, i);
+            }
             emit_store(state, S32, src, dst, inst.offset);
             break;
         case EBPF_OP_STXH:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 2, i);
+            }
             emit_store(state, S16, src, dst, inst.offset);
             break;
         case EBPF_OP_STXB:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 1, i);
+            }
             emit_store(state, S8, src, dst, inst.offset);
             break;
         case EBPF_OP_STXDW:
+            if (vm->bounds_check_enabled) {
+                emit_bounds_check(vm, state, inst.dst, inst.offset, 8, i);
+            }
             emit_store(state, S64, src, dst, inst.offset);
             break;
 
@@ -549,18 +858,29 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
             *errmsg = ubpf_error("Unknown instruction at PC %d: opcode %02x", i, inst.opcode);
             return -1;
         }
+
+        if (charge && inst.opcode != EBPF_OP_JA && state->num_jumps > num_jumps) {
+            /* The fall-through path skips the charge of the taken edge */
+            uint32_t not_taken = emit_short_jmp(state);
+            patch_last_jump(state);
+            emit_budget_charge(state, i - target_pc + 1);
+            emit_jmp(state, target_pc);
+            patch_short_jump(state, not_taken);
+        }
     }
 
     /* Epilogue */
     state->exit_loc = state->offset;
+    state->pc_locs[vm->num_insts] = state->offset;
 
     /* Move register 0 into rax */
     if (map_register(0) != RAX) {
         emit_mov(state, map_register(0), RAX);
     }
 
-    /* Deallocate stack space */
-    emit_alu64_imm32(state, 0x81, 0, RSP, UBPF_STACK_SIZE);
+    /* Deallocate stack space, including any nested BPF-to-BPF call frames */
+    emit_mov(state, FRAME_BASE, RSP);
+    emit_alu64_imm32(state, 0x81, 0, RSP, SCRATCH_SIZE);
 
     /* Restore platform non-volatile registers */
     for (i = 0; i < _countof(platform_nonvolatile_registers); i++) {
@@ -569,6 +889,28 @@ translate(struct ubpf_vm* vm, struct jit_state* state, char** errmsg)
 
     emit1(state, 0xc3); /* ret */
 
+    /* Cold path of the bounds checks: report the PC in RCX */
+    state->bounds_error_loc = state->offset;
+    emit_mov(state, RCX, platform_parameter_registers[1]);
+    emit_load_imm(state, platform_parameter_registers[0], (uintptr_t)vm);
+    emit_call(state, ubpf_jit_bounds_error);
+    uint32_t report_fault = emit_short_jmp(state);
+
+    /* Abort stub of the instruction budget */
+    state->budget_exhausted_loc = state->offset;
+    emit_load_imm(state, platform_parameter_registers[0], (uintptr_t)vm);
+    emit_call(state, ubpf_jit_budget_exhausted);
+
+    /* Set the fault flag of ubpf_exec_jit(), if any, and return -1 */
+    patch_short_jump(state, report_fault);
+    emit_load(state, S64, FRAME_BASE, RCX, SCRATCH_SLOT_OFFSET(SCRATCH_SLOT_FAULT));
+    emit_alu64(state, 0x85, RCX, RCX);
+    uint32_t no_flag = emit_short_jcc(state, 0x74); /* jz */
+    emit_store_imm32(state, S32, RCX, 0, 1);
+    patch_short_jump(state, no_flag);
+    emit_load_imm(state, map_register(0), -1);
+    emit_jmp(state, TARGET_PC_EXIT);
+
     return 0;
 }
 
@@ -708,6 +1050,10 @@ resolve_jumps(struct jit_state* state)
             target_loc = state->exit_loc;
         } else if (jump.target_pc == TARGET_PC_DIV_BY_ZERO) {
             target_loc = state->div_by_zero_loc;
+        } else if (jump.target_pc == TARGET_PC_BOUNDS_ERROR) {
+            target_loc = state->bounds_error_loc;
+        } else if (jump.target_pc == TARGET_PC_BUDGET_EXHAUSTED) {
+            target_loc = state->budget_exhausted_loc;
         } else {
             target_loc = state->pc_locs[jump.target_pc];
         }
@@ -22,6 +22,7 @@
 #define UBPF_JIT_X86_64_H
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -65,6 +66,8 @@ struct jit_state
     uint32_t* pc_locs;
     uint32_t exit_loc;
     uint32_t div_by_zero_loc;
+    uint32_t bounds_error_loc;
+    uint32_t budget_exhausted_loc;
     uint32_t unwind_loc;
     struct jump* jumps;
     int num_jumps;
@@ -134,13 +137,24 @@ emit_modrm_reg2reg(struct jit_state* state, int r, int m)
 static inline void
 emit_modrm_and_displacement(struct jit_state* state, int r, int m, int32_t d)
 {
+    /* RSP and R12 as base need a SIB byte (no index) */
+    bool sib = (m & 7) == RSP;
     if (d == 0 && (m & 7) != RBP) {
         emit_modrm(state, 0x00, r, m);
+        if (sib) {
+            emit1(state, 0x24);
+        }
     } else if (d >= -128 && d <= 127) {
         emit_modrm(state, 0x40, r, m);
+        if (sib) {
+            emit1(state, 0x24);
+        }
         emit1(state, d);
     } else {
         emit_modrm(state, 0x80, r, m);
+        if (sib) {
+            emit1(state, 0x24);
+        }
         emit4(state, d);
     }
 }
@@ -364,6 +378,46 @@ emit_call(struct jit_state* state, void* target)
 #endif
 }
 
+/* Emit a jcc rel8 (code is 0x70-0x7f) whose target is set by patch_short_jump */
+static inline uint32_t
+emit_short_jcc(struct jit_state* state, int code)
+{
+    emit1(state, code);
+    emit1(state, 0);
+    return state->offset - 1;
+}
+
+/* Emit a jmp rel8 whose target is set by patch_short_jump */
+static inline uint32_t
+emit_short_jmp(struct jit_state* state)
+{
+    emit1(state, 0xeb);
+    emit1(state, 0);
+    return state->offset - 1;
+}
+
+/* Point the short jump with displacement at loc to the current offset */
+static inline void
+patch_short_jump(struct jit_state* state, uint32_t loc)
+{
+    int32_t rel = state->offset - (loc + 1);
+    assert(rel <= INT8_MAX);
+    if (loc < state->size) {
+        state->buf[loc] = rel;
+    }
+}
+
+/* Make the last jump recorded by emit_jump_offset land at the current offset */
+static inline void
+patch_last_jump(struct jit_state* state)
+{
+    struct jump* jump = &state->jumps[--state->num_jumps];
+    uint32_t rel = state->offset - (jump->offset_loc + sizeof(uint32_t));
+    if (jump->offset_loc + sizeof(uint32_t) <= state->size) {
+        memcpy(&state->buf[jump->offset_loc], &rel, sizeof(uint32_t));
+    }
+}
+
 static inline void
 emit_jmp(struct jit_state* state, uint32_t target_pc)
 {
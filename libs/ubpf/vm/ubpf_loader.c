@@ -35,6 +35,10 @@
 #define EM_BPF 247
 #endif
 
+#ifndef R_BPF_64_32
+#define R_BPF_64_32 10
+#endif
+
 #if defined(UBPF_HAS_ELF_H)
 
 struct bounds
@@ -193,7 +197,7 @@ ubpf_load_elf(struct ubpf_vm* vm, const void* elf, size_t elf_size, char** errms
             Elf64_Rel r;
             memcpy(&r, rs + j, sizeof(Elf64_Rel));
 
-            if (ELF64_R_TYPE(r.r_info) != 2) {
+            if (ELF64_R_TYPE(r.r_info) != 2 && ELF64_R_TYPE(r.r_info) != R_BPF_64_32) {
                 *errmsg = ubpf_error("bad relocation type %u", ELF64_R_TYPE(r.r_info));
                 goto error;
             }
@@ -220,6 +224,21 @@ ubpf_load_elf(struct ubpf_vm* vm, const void* elf, size_t elf_size, char** errms
                 goto error;
             }
 
+            /*
+             * BPF-to-BPF call: the target is sym + imm + 1 instructions,
+             * turn it into an offset relative to the call itself.
+             */
+            struct ebpf_inst* inst = (struct ebpf_inst*)(text_copy + r.r_offset);
+            if (inst->opcode == EBPF_OP_CALL && inst->src == EBPF_CALL_LOCAL) {
+                if (sym.st_shndx != text_shndx) {
+                    *errmsg = ubpf_error("call to '%s' outside of the text section", sym_name);
+                    goto error;
+                }
+                int64_t target = sym.st_value / 8 + inst->imm + 1;
+                inst->imm = target - r.r_offset / 8 - 1;
+                continue;
+            }
+
             unsigned int imm = ubpf_lookup_registered_function(vm, sym_name);
             if (imm == -1) {
                 *errmsg = ubpf_error("function '%s' not found", sym_name);
@@ -29,7 +29,9 @@
 #define MAX_EXT_FUNCS 64
 
 static bool
-validate(const struct ubpf_vm* vm, const struct ebpf_inst* insts, uint32_t num_insts, char** errmsg);
+validate(const struct ubpf_vm* vm, const struct ebpf_inst* insts, uint32_t num_insts, int* call_depth, char** errmsg);
+static bool
+validate_functions(const struct ebpf_inst* insts, uint32_t num_insts, int* call_depth, char** errmsg);
 static bool
 bounds_check(
     const struct ubpf_vm* vm,
@@ -39,7 +41,8 @@ bounds_check(
     uint16_t cur_pc,
     void* mem,
     size_t mem_len,
-    void* stack);
+    void* stack,
+    size_t stack_len);
 
 bool
 ubpf_toggle_bounds_check(struct ubpf_vm* vm, bool enable)
@@ -79,16 +82,19 @@ ubpf_create(void)
     }
 
     vm->bounds_check_enabled = true;
+    vm->instruction_budget = UBPF_DEFAULT_INSTRUCTION_BUDGET;
     vm->error_printf = fprintf;
 
 #if defined(__x86_64__) || defined(_M_X64)
     vm->translate = ubpf_translate_x86_64;
-#elif defined(__aarch64__) || defined(_M_ARM64)
+#elif (defined(__aarch64__) || defined(_M_ARM64)) && !defined(UBPF_DISABLE_JIT_ARM64)
     vm->translate = ubpf_translate_arm64;
 #else
     vm->translate = ubpf_translate_null;
 #endif
     vm->unwind_stack_extension_index = -1;
+    vm->tail_call_extension_index = -1;
+    vm->stack_size = UBPF_STACK_SIZE;
     return vm;
 }
 
@@ -125,6 +131,54 @@ ubpf_set_unwind_function_index(struct ubpf_vm* vm, unsigned int idx)
     return 0;
 }
 
+int
+ubpf_set_instruction_budget(struct ubpf_vm* vm, uint32_t budget)
+{
+    if (budget > INT32_MAX) {
+        return -1;
+    }
+
+    vm->instruction_budget = budget;
+    return 0;
+}
+
+/*
+ * A tail call target runs on the stack of the program that started the chain
+ * and may use more call levels than it, so such programs reserve all levels.
+ */
+static bool
+makes_tail_calls(const struct ubpf_vm* vm)
+{
+    for (uint32_t i = 0; i < vm->num_insts; i++) {
+        struct ebpf_inst inst = ubpf_fetch_instruction(vm, i);
+        if (inst.opcode == EBPF_OP_CALL && inst.src != EBPF_CALL_LOCAL && inst.imm == vm->tail_call_extension_index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int
+ubpf_set_tail_call_function_index(struct ubpf_vm* vm, unsigned int idx)
+{
+    if (vm->tail_call_extension_index != -1) {
+        return -1;
+    }
+
+    vm->tail_call_extension_index = idx;
+    if (vm->insts && makes_tail_calls(vm)) {
+        vm->stack_size = UBPF_TOTAL_STACK_SIZE;
+    }
+    return 0;
+}
+
+int
+ubpf_set_stack_hook(struct ubpf_vm* vm, void (*hook)(void* stack, size_t size))
+{
+    vm->stack_hook = hook;
+    return 0;
+}
+
 unsigned int
 ubpf_lookup_registered_function(struct ubpf_vm* vm, const char* name)
 {
@@ -142,6 +196,7 @@ int
 ubpf_load(struct ubpf_vm* vm, const void* code, uint32_t code_len, char** errmsg)
 {
     const struct ebpf_inst* source_inst = code;
+    int call_depth = 1;
     *errmsg = NULL;
 
     if (vm->insts) {
@@ -155,7 +210,7 @@ ubpf_load(struct ubpf_vm* vm, const void* code, uint32_t code_len, char** errmsg
         return -1;
     }
 
-    if (!validate(vm, code, code_len / 8, errmsg)) {
+    if (!validate(vm, code, code_len / 8, &call_depth, errmsg)) {
         return -1;
     }
 
@@ -172,6 +227,9 @@ ubpf_load(struct ubpf_vm* vm, const void* code, uint32_t code_len, char** errmsg
         ubpf_store_instruction(vm, i, source_inst[i]);
     }
 
+    /* Reserve only the call levels the program can reach */
+    vm->stack_size = makes_tail_calls(vm) ? UBPF_TOTAL_STACK_SIZE : call_depth * UBPF_STACK_SIZE;
+
     return 0;
 }
 
@@ -182,12 +240,15 @@ ubpf_unload_code(struct ubpf_vm* vm)
         munmap(vm->jitted, vm->jitted_size);
         vm->jitted = NULL;
         vm->jitted_size = 0;
+        vm->jitted_tail_call_entry = NULL;
+        vm->jitted_fault_entry = NULL;
     }
     if (vm->insts) {
         free(vm->insts);
         vm->insts = NULL;
         vm->num_insts = 0;
     }
+    vm->stack_size = UBPF_STACK_SIZE;
 }
 
 static uint32_t
@@ -254,15 +315,35 @@ ubpf_mem_store(uint64_t address, uint64_t value, size_t size)
     }
 }
 
+/* State saved by a BPF-to-BPF call and restored by the matching exit */
+struct ubpf_call_frame
+{
+    uint16_t return_pc;
+    uint64_t saved_registers[4]; /* r6-r9 */
+};
+
 int
 ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_return_value)
+{
+    uint32_t count;
+    return ubpf_exec_count(vm, mem, mem_len, bpf_return_value, &count);
+}
+
+int
+ubpf_exec_count(
+    const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_return_value, uint32_t* instruction_count)
 {
     uint16_t pc = 0;
     const struct ebpf_inst* insts = vm->insts;
     uint64_t* reg;
     uint64_t _reg[16];
-    uint64_t stack[(UBPF_STACK_SIZE + 7) / 8];
+    /* One frame per call level the program can reach, see ubpf_load() */
+    uint64_t stack[vm->stack_size / sizeof(uint64_t)];
+    struct ubpf_call_frame frames[vm->stack_size / UBPF_STACK_SIZE];
+    unsigned int frame_index = 0;
+    unsigned int tail_calls = 0;
 
+    *instruction_count = 0;
     if (!insts) {
         /* Code must be loaded before we can execute */
         return -1;
@@ -280,15 +361,20 @@ ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_ret
     reg[1] = (uintptr_t)mem;
     reg[2] = (uint64_t)mem_len;
     reg[10] = (uintptr_t)stack + sizeof(stack);
+    if (vm->stack_hook) {
+        vm->stack_hook(stack, sizeof(stack));
+    }
 
-    unsigned count = 0;
+    /* Tail calls share the budget of the first program */
+    const uint32_t budget = vm->instruction_budget;
+    uint32_t count = 0;
     while (1) {
         const uint16_t cur_pc = pc;
         struct ebpf_inst inst = ubpf_fetch_instruction(vm, pc++);
 
         count++;
-#define MAX_INSTRUCTIONS 1000000
-        if (count >= MAX_INSTRUCTIONS) {
+        if (budget && count >= budget) {
+            *instruction_count = count;
             return -1;
         }
 
@@ -495,13 +581,15 @@ ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_ret
              */
 #define BOUNDS_CHECK_LOAD(size)                                                                                 \
     do {                                                                                                        \
-        if (!bounds_check(vm, (char*)reg[inst.src] + inst.offset, size, "load", cur_pc, mem, mem_len, stack)) { \
+        if (!bounds_check(vm, (char*)reg[inst.src] + inst.offset, size, "load", cur_pc, mem, mem_len, stack, sizeof(stack))) { \
+            *instruction_count = count;                                                                         \
             return -1;                                                                                          \
         }                                                                                                       \
     } while (0)
 #define BOUNDS_CHECK_STORE(size)                                                                                 \
     do {                                                                                                         \
-        if (!bounds_check(vm, (char*)reg[inst.dst] + inst.offset, size, "store", cur_pc, mem, mem_len, stack)) { \
+        if (!bounds_check(vm, (char*)reg[inst.dst] + inst.offset, size, "store", cur_pc, mem, mem_len, stack, sizeof(stack))) { \
+            *instruction_count = count;                                                                          \
             return -1;                                                                                           \
         }                                                                                                        \
     } while (0)
@@ -785,13 +873,47 @@ ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_ret
             }
             break;
         case EBPF_OP_EXIT:
+            if (frame_index > 0) {
+                /* Return from a BPF-to-BPF call */
+                frame_index--;
+                pc = frames[frame_index].return_pc;
+                memcpy(&reg[6], frames[frame_index].saved_registers, sizeof(frames[frame_index].saved_registers));
+                reg[10] += UBPF_STACK_SIZE;
+                break;
+            }
             *bpf_return_value = reg[0];
+            *instruction_count = count;
             return 0;
         case EBPF_OP_CALL:
+            if (inst.src == EBPF_CALL_LOCAL) {
+                /* Depth is bounded by validate() */
+                frames[frame_index].return_pc = pc;
+                memcpy(frames[frame_index].saved_registers, &reg[6], sizeof(frames[frame_index].saved_registers));
+                frame_index++;
+                reg[10] -= UBPF_STACK_SIZE;
+                pc += inst.imm;
+                break;
+            }
+            if (inst.imm == vm->tail_call_extension_index) {
+                const struct ubpf_vm* next =
+                    (const struct ubpf_vm*)(uintptr_t)vm->ext_funcs[inst.imm](reg[1], reg[2], reg[3], reg[4], reg[5]);
+                if (next == NULL || next->insts == NULL || tail_calls >= UBPF_MAX_TAIL_CALLS) {
+                    reg[0] = UINT64_MAX;
+                    break;
+                }
+                /* Continue in the entry of the next program, keeping r1 */
+                tail_calls++;
+                vm = next;
+                pc = 0;
+                frame_index = 0;
+                reg[10] = (uintptr_t)stack + sizeof(stack);
+                break;
+            }
             reg[0] = vm->ext_funcs[inst.imm](reg[1], reg[2], reg[3], reg[4], reg[5]);
             // Unwind the stack if unwind extension returns success.
             if (inst.imm == vm->unwind_stack_extension_index && reg[0] == 0) {
                 *bpf_return_value = reg[0];
+                *instruction_count = count;
                 return 0;
             }
             break;
@@ -800,13 +922,14 @@ ubpf_exec(const struct ubpf_vm* vm, void* mem, size_t mem_len, uint64_t* bpf_ret
 }
 
 static bool
-validate(const struct ubpf_vm* vm, const struct ebpf_inst* insts, uint32_t num_insts, char** errmsg)
+validate(const struct ubpf_vm* vm, const struct ebpf_inst* insts, uint32_t num_insts, int* call_depth, char** errmsg)
 {
     if (num_insts >= UBPF_MAX_INSTS) {
         *errmsg = ubpf_error("too many instructions (max %u)", UBPF_MAX_INSTS);
         return false;
     }
 
+    bool has_local_calls = false;
     int i;
     for (i = 0; i < num_insts; i++) {
         struct ebpf_inst inst = insts[i];
@@ -960,6 +1083,22 @@ validate(const struct ubpf_vm* vm, const struct ebpf_inst* insts, uint32_t num_i
             break;
 
         case EBPF_OP_CALL:
+            if (inst.src == EBPF_CALL_LOCAL) {
+                int target_pc = i + 1 + inst.imm;
+                if (target_pc < 0 || target_pc >= num_insts) {
+                    *errmsg = ubpf_error("call out of bounds at PC %d", i);
+                    return false;
+                } else if (insts[target_pc].opcode == 0) {
+                    *errmsg = ubpf_error("call to middle of lddw at PC %d", i);
+                    return false;
+                }
+                has_local_calls = true;
+                break;
+            }
+            if (inst.src != EBPF_CALL_HELPER) {
+                *errmsg = ubpf_error("invalid call source at PC %d", i);
+                return false;
+            }
             if (inst.imm < 0 || inst.imm >= MAX_EXT_FUNCS) {
                 *errmsg = ubpf_error("invalid call immediate at PC %d", i);
                 return false;
@@ -995,9 +1134,129 @@ validate(const struct ubpf_vm* vm, const struct ebpf_inst* insts, uint32_t num_i
         }
     }
 
+    if (has_local_calls) {
+        return validate_functions(insts, num_insts, call_depth, errmsg);
+    }
+
     return true;
 }
 
+/*
+ * Height of the call tree rooted at function func, or -1 with *errmsg set if
+ * it recurses or exceeds UBPF_MAX_CALL_DEPTH. level is the depth of func
+ * itself, which keeps this recursion bounded by UBPF_MAX_CALL_DEPTH as well.
+ */
+static int
+call_tree_height(
+    const struct ebpf_inst* insts,
+    const uint32_t* func_start,
+    const uint32_t* func_of,
+    int* height,
+    uint32_t func,
+    int level,
+    char** errmsg)
+{
+    if (height[func] > 0) {
+        if (level + height[func] - 1 > UBPF_MAX_CALL_DEPTH) {
+            *errmsg = ubpf_error("call depth exceeds %d in function at PC %u", UBPF_MAX_CALL_DEPTH, func_start[func]);
+            return -1;
+        }
+        return height[func];
+    }
+    if (height[func] < 0) {
+        *errmsg = ubpf_error("recursive call of function at PC %u", func_start[func]);
+        return -1;
+    }
+    if (level > UBPF_MAX_CALL_DEPTH) {
+        *errmsg = ubpf_error("call depth exceeds %d in function at PC %u", UBPF_MAX_CALL_DEPTH, func_start[func]);
+        return -1;
+    }
+
+    /* Mark as in progress */
+    height[func] = -1;
+    int h = 1;
+    for (uint32_t i = func_start[func]; i < func_start[func + 1]; i++) {
+        if (insts[i].opcode == EBPF_OP_CALL && insts[i].src == EBPF_CALL_LOCAL) {
+            uint32_t callee = func_of[i + 1 + insts[i].imm];
+            int callee_height = call_tree_height(insts, func_start, func_of, height, callee, level + 1, errmsg);
+            if (callee_height < 0) {
+                return -1;
+            }
+            if (callee_height + 1 > h) {
+                h = callee_height + 1;
+            }
+        }
+    }
+    height[func] = h;
+    return h;
+}
+
+/*
+ * Split a program using BPF-to-BPF calls into functions (the entry point and
+ * every call target) and check that control flow stays within them and that
+ * calls do not recurse or nest deeper than UBPF_MAX_CALL_DEPTH. The number of
+ * call levels used is stored in *call_depth.
+ */
+static bool
+validate_functions(const struct ebpf_inst* insts, uint32_t num_insts, int* call_depth, char** errmsg)
+{
+    bool ok = false;
+    uint32_t num_funcs = 0;
+    uint32_t* func_of = calloc(num_insts, sizeof(*func_of));
+    uint32_t* func_start = calloc(num_insts + 1, sizeof(*func_start));
+    int* height = calloc(num_insts, sizeof(*height));
+    if (func_of == NULL || func_start == NULL || height == NULL) {
+        *errmsg = ubpf_error("out of memory");
+        goto out;
+    }
+
+    /* Use func_of to flag the first instruction of each function */
+    func_of[0] = 1;
+    for (uint32_t i = 0; i < num_insts; i++) {
+        if (insts[i].opcode == EBPF_OP_CALL && insts[i].src == EBPF_CALL_LOCAL) {
+            func_of[i + 1 + insts[i].imm] = 1;
+        }
+    }
+    for (uint32_t i = 0; i < num_insts; i++) {
+        if (func_of[i]) {
+            func_start[num_funcs++] = i;
+        }
+        func_of[i] = num_funcs - 1;
+    }
+    func_start[num_funcs] = num_insts;
+
+    for (uint32_t f = 0; f < num_funcs; f++) {
+        uint8_t last = insts[func_start[f + 1] - 1].opcode;
+        if (last != EBPF_OP_EXIT && last != EBPF_OP_JA) {
+            *errmsg = ubpf_error("function at PC %u does not end with exit or jump", func_start[f]);
+            goto out;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_insts; i++) {
+        uint8_t opcode = insts[i].opcode;
+        uint8_t cls = opcode & EBPF_CLS_MASK;
+        if (opcode == EBPF_OP_LDDW) {
+            i++;
+            continue;
+        }
+        if ((cls == EBPF_CLS_JMP || cls == EBPF_CLS_JMP32) && opcode != EBPF_OP_CALL && opcode != EBPF_OP_EXIT &&
+            func_of[i + 1 + insts[i].offset] != func_of[i]) {
+            *errmsg = ubpf_error("jump out of function at PC %u", i);
+            goto out;
+        }
+    }
+
+    *call_depth = call_tree_height(insts, func_start, func_of, height, 0, 1, errmsg);
+    ok = *call_depth > 0;
+
+out:
+    free(func_of);
+    free(func_start);
+    free(height);
+    return ok;
+}
+
 static bool
 bounds_check(
     const struct ubpf_vm* vm,
@@ -1007,20 +1266,21 @@ bounds_check(
     uint16_t cur_pc,
     void* mem,
     size_t mem_len,
-    void* stack)
+    void* stack,
+    size_t stack_len)
 {
     if (!vm->bounds_check_enabled)
         return true;
     if (mem && (addr >= mem && ((char*)addr + size) <= ((char*)mem + mem_len))) {
         /* Context access */
         return true;
-    } else if (addr >= stack && ((char*)addr + size) <= ((char*)stack + UBPF_STACK_SIZE)) {
+    } else if (addr >= stack && ((char*)addr + size) <= ((char*)stack + stack_len)) {
         /* Stack access */
         return true;
     } else {
         vm->error_printf(
             stderr,
-            "uBPF error: out of bounds memory %s at PC %u, addr %p, size %d\nmem %p/%zd stack %p/%d\n",
+            "uBPF error: out of bounds memory %s at PC %u, addr %p, size %d\nmem %p/%zd stack %p/%zd\n",
             type,
             cur_pc,
             addr,
@@ -1028,11 +1288,25 @@ bounds_check(
             mem,
             mem_len,
             stack,
-            UBPF_STACK_SIZE);
+            stack_len);
         return false;
     }
 }
 
+/* Called by jitted code when a checked memory access is out of bounds */
+void
+ubpf_jit_bounds_error(const struct ubpf_vm* vm, uint64_t pc)
+{
+    vm->error_printf(stderr, "uBPF error: out of bounds memory access at PC %u\n", (unsigned)pc);
+}
+
+/* Called by jitted code when the instruction budget is exhausted */
+void
+ubpf_jit_budget_exhausted(const struct ubpf_vm* vm)
+{
+    vm->error_printf(stderr, "uBPF error: instruction budget of %u exhausted\n", vm->instruction_budget);
+}
+
 char*
 ubpf_error(const char* fmt, ...)
 {
@@ -44,6 +44,10 @@ struct THmapValueResult *hmap_put(struct THashMap *hmap, uint64_t key,
 
 struct THmapValueResult *hmap_get(struct THashMap *hmap, uint64_t key);
 
+// the value of key, or NULL if absent; unlike hmap_get it doesn't allocate,
+// so it can be used on probe hits
+void *hmap_find(struct THashMap *hmap, uint64_t key);
+
 struct THmapValueResult *hmap_get_or_create(struct THashMap *hmap,
                                             uint64_t key);
 
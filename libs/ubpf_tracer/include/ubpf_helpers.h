@@ -27,14 +27,42 @@
     ubpf_register(vm, idx, label, fun_ptr);                                    \
   }
 
+#ifdef CONFIG_UKPLAT_LCPU_MAXCOUNT
+#define UBPF_TRACER_MAX_CPUS CONFIG_UKPLAT_LCPU_MAXCOUNT
+#else
+#define UBPF_TRACER_MAX_CPUS 1
+#endif
+
+// index of the current CPU into per-CPU arrays
+static inline unsigned int tracer_cpu_id() {
+  unsigned int ukplat_lcpu_id(void);
+  return ukplat_lcpu_id() % UBPF_TRACER_MAX_CPUS;
+}
+
 // BPF helperes
 uint64_t bpf_map_get(uint64_t key1, uint64_t key2);
 void bpf_map_put(uint64_t key1, uint64_t key2, uint64_t value);
 void bpf_map_del(uint64_t key1, uint64_t key2);
 uint64_t bpf_get_addr(const char *function_name);
 uint64_t bpf_probe_read(uint64_t addr, uint64_t size);
+uint64_t bpf_probe_read_bytes(void *dst, uint64_t size, uint64_t src);
+void bpf_probe_read_cache_flush();
+uint64_t tracer_stack_walk(uint64_t frame, uint64_t *ips, uint64_t max);
 uint64_t bpf_time_get_ns();
+uint64_t bpf_read_pmc(uint64_t idx);
 void bpf_puts(char *buf);
+uint64_t bpf_printk(const char *fmt, uint64_t arg1, uint64_t arg2,
+                    uint64_t arg3, uint64_t arg4);
+uint64_t bpf_tail_call(void *ctx, uint64_t index);
+
+// BPF stack of a program run, see bpf_prog_run_begin()
+struct bpf_stack_range {
+  uint64_t start;
+  uint64_t end;
+};
+void bpf_prog_run_begin(struct bpf_stack_range *saved);
+void bpf_prog_run_end(const struct bpf_stack_range *saved);
+int bpf_stack_range_ok(uint64_t addr, uint64_t size);
 
 struct ubpf_vm *init_vm(struct ArrayListWithLabels *helper_list, FILE *logfile);
 struct ArrayListWithLabels *init_helper_list();
@@ -42,9 +70,15 @@ void additional_helpers_list_add(const char *label, void *function_ptr);
 void additional_helpers_list_del(const char *label);
 
 void *readfile(const char *path, size_t maxlen, size_t *len);
+void *read_bpf_program(const char *path, size_t *len,
+                       void (*print_fn)(char *str));
 
 // shell commands
 int bpf_exec(const char *filename, void *args, size_t args_size, int debug,
              void (*print_fn)(char *str));
+int bpf_prog_array_set(uint64_t index, const char *filename,
+                       void (*print_fn)(char *str));
+int bpf_prog_array_del(uint64_t index, void (*print_fn)(char *str));
+int bpf_trace_print(void (*print_fn)(char *str));
 
 #endif /* UBPF_HELPERS_H */
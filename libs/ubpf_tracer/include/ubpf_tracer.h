@@ -22,10 +22,48 @@ struct UbpfTracer {
   struct THashMap *nop_map;        // { function_address -> nop_address }
   struct THashMap *vm_map;         // { ret_address -> List<(label, ubpf_vm)> }
   struct THashMap *function_names; // { ret_address -> function_name }
+  struct THashMap *stack_map;      // { stack_id -> struct TracerStack }
+  uint64_t stack_map_dropped;      // stacks not stored, map full or collision
   struct ArrayListWithLabels
       *helper_list; // [(function_name, function_address)]
 };
 
+// counters of an attached program on one CPU
+struct UbpfTracerProbeStats {
+  uint64_t hits;         // including the ones skipped by sampling
+  uint64_t runs;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t instructions; // interpreter only, 0 with UBPF_TRACER_JIT
+  uint64_t errors;
+};
+
+// sampling and rate limit state of an attached program on one CPU
+struct UbpfTracerProbeSampling {
+  uint64_t sample_countdown;
+  uint64_t rate_tokens;
+  uint64_t rate_window_ns;
+};
+
+// an attached program and when to run it
+struct UbpfTracerProbe {
+  struct ubpf_vm *vm;
+  uint64_t sample_every;    // run on 1 in sample_every hits, 0 = every hit
+  uint64_t rate_limit;      // max runs per second and CPU, 0 = unlimited
+  struct UbpfTracerProbeSampling sampling[UBPF_TRACER_MAX_CPUS];
+  struct UbpfTracerProbeStats stats[UBPF_TRACER_MAX_CPUS];
+  void *store; // uk_store object with the stats, see probe_store_add()
+};
+
+#define TRACER_STACK_MAX_DEPTH 32
+#define TRACER_STACK_MAP_MAX 4096
+
+// call chain of a probe hit, innermost first
+struct TracerStack {
+  uint64_t nr;
+  uint64_t ips[TRACER_STACK_MAX_DEPTH];
+};
+
 struct UbpfTracerCtx {
   uint64_t traced_function_address;
   char buf[120];
@@ -46,17 +84,29 @@ uint64_t get_function_address(struct UbpfTracer *tracer,
 uint64_t get_nop_address(struct UbpfTracer *tracer, uint64_t function_address);
 uint64_t find_nop_address(struct UbpfTracer *tracer, const char *function_name,
                           void (*print_fn)(char *str));
+struct UbpfTracerProbe *find_probe(struct UbpfTracer *tracer,
+                                   const char *function_name,
+                                   const char *bpf_filename,
+                                   void (*print_fn)(char *str));
 void tracer_helpers_add(struct UbpfTracer *tracer, const char *label,
                         void *function_ptr);
 void tracer_helpers_del(struct UbpfTracer *tracer, const char *label);
-void run_bpf_program();
+void run_bpf_program(uint64_t ret_addr, uint64_t frame);
+void probe_stats_sum(const struct UbpfTracerProbe *probe,
+                     struct UbpfTracerProbeStats *sum);
+void tracer_stats_sum(struct UbpfTracer *tracer,
+                      struct UbpfTracerProbeStats *sum);
 
 void *readfile(const char *path, size_t maxlen, size_t *len);
+void *read_bpf_program(const char *path, size_t *len,
+                       void (*print_fn)(char *str));
 
 // BPF helpers
 void bpf_notify(void *function_id);
 uint64_t bpf_get_ret_addr(const char *function_name);
 uint64_t bpf_get_addr(const char *function_name);
+uint64_t bpf_get_stack(void *buf, uint64_t size);
+uint64_t bpf_get_stackid(uint64_t max_depth);
 
 // shell commands
 int bpf_attach(const char *function_name, const char *bpf_filename,
@@ -64,5 +114,10 @@ int bpf_attach(const char *function_name, const char *bpf_filename,
 int bpf_list(const char *function_name, void (*print_fn)(char *str));
 int bpf_detach(const char *function_name, const char *bpf_filename,
                void (*print_fn)(char *str));
+int bpf_sample(const char *function_name, const char *bpf_filename,
+               uint64_t every, void (*print_fn)(char *str));
+int bpf_rate_limit(const char *function_name, const char *bpf_filename,
+                   uint64_t per_second, void (*print_fn)(char *str));
+int bpf_stacks(uint64_t count_key, void (*print_fn)(char *str));
 
 #endif /* UBPF_TRACER_H */
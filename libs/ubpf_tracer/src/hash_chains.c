@@ -174,6 +174,18 @@ struct THmapValueResult *hmap_get(struct THashMap *hmap, uint64_t key) {
   return result;
 }
 
+void *hmap_find(struct THashMap *hmap, uint64_t key) {
+  if (hmap == NULL)
+    return NULL;
+  for (struct THashCell *cell = hmap->m_Map[key % hmap->m_Size]; cell != NULL;
+       cell = cell->m_Next) {
+    if (cell->m_Key == key) {
+      return cell->m_Value;
+    }
+  }
+  return NULL;
+}
+
 struct THmapValueResult *hmap_get_or_create(struct THashMap *hmap,
                                             uint64_t key) {
   struct THmapValueResult *result = hmap_get(hmap, key);
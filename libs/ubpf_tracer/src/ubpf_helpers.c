@@ -1,6 +1,14 @@
 #include "ubpf_helpers.h"
 #include "ubpf.h"
 #include <stdio.h>
+#include <sys/stat.h>
+
+#ifdef CONFIG_LIBPMU
+#include <pmu.h>
+#endif
+#ifdef CONFIG_LIBUKSCHED
+#include <uk/sched.h>
+#endif
 
 // #define UBPF_DEBUG
 #ifdef UBPF_DEBUG
@@ -16,6 +24,7 @@
 #endif
 
 struct THashMap *g_bpf_map = NULL;
+struct THashMap *g_bpf_prog_array = NULL;
 struct ArrayListWithLabels *additional_helpers = NULL;
 
 void destruct_cell_l2(struct THashCell *cell) { free(cell->m_Value); }
@@ -111,6 +120,99 @@ void bpf_map_dump(void (*print_fn)(char *str)) {
 
 uint64_t bpf_unwind(uint64_t i) { return i; }
 
+// program array for bpf_tail_call: index -> struct ubpf_vm. Removed programs
+// are destroyed by bpf_prog_array_retire(), not by the map.
+void destruct_cell_prog(struct THashCell *cell) { (void)cell; }
+void *create_cell_prog() { return NULL; }
+
+// Each CPU counts the program runs it starts and ends, the count is odd while
+// a run (including its tail calls) is in progress.
+static uint64_t bpf_prog_runs[UBPF_TRACER_MAX_CPUS];
+
+// BPF stack of the program running on each CPU, reported by ubpf when the
+// program starts (see ubpf_set_stack_hook). Empty outside of runs.
+static struct bpf_stack_range bpf_stacks[UBPF_TRACER_MAX_CPUS];
+
+static void bpf_stack_hook(void *stack, size_t size) {
+  struct bpf_stack_range *range = &bpf_stacks[tracer_cpu_id()];
+  range->start = (uint64_t)stack;
+  range->end = (uint64_t)stack + size;
+}
+
+// Probes can hit within a run (in a traced function called by a helper), so a
+// run keeps the stack range of the one it interrupted in saved.
+void bpf_prog_run_begin(struct bpf_stack_range *saved) {
+  unsigned int cpu = tracer_cpu_id();
+  *saved = bpf_stacks[cpu];
+  __atomic_add_fetch(&bpf_prog_runs[cpu], 1, __ATOMIC_SEQ_CST);
+}
+
+void bpf_prog_run_end(const struct bpf_stack_range *saved) {
+  unsigned int cpu = tracer_cpu_id();
+  bpf_stacks[cpu] = *saved;
+  __atomic_add_fetch(&bpf_prog_runs[cpu], 1, __ATOMIC_RELEASE);
+}
+
+// whether [addr, addr + size) lies within the stack of the running program,
+// the only memory helpers write to
+int bpf_stack_range_ok(uint64_t addr, uint64_t size) {
+  const struct bpf_stack_range *range = &bpf_stacks[tracer_cpu_id()];
+  return addr >= range->start && size <= range->end - addr &&
+         addr < range->end;
+}
+
+// Destroy a program that was removed from the array. A run that started before
+// the removal can still tail call into it, so wait until every CPU that was in
+// a run has ended it. Runs on this CPU only pause in helpers that block (like
+// bpf_puts on the shell socket), the other threads get to finish them.
+static void bpf_prog_array_retire(struct ubpf_vm *vm) {
+  uint64_t seen[UBPF_TRACER_MAX_CPUS];
+  for (unsigned int cpu = 0; cpu < UBPF_TRACER_MAX_CPUS; ++cpu) {
+    seen[cpu] = __atomic_load_n(&bpf_prog_runs[cpu], __ATOMIC_SEQ_CST);
+  }
+  for (unsigned int cpu = 0; cpu < UBPF_TRACER_MAX_CPUS; ++cpu) {
+    while (seen[cpu] % 2 == 1 &&
+           __atomic_load_n(&bpf_prog_runs[cpu], __ATOMIC_ACQUIRE) == seen[cpu]) {
+#ifdef CONFIG_LIBUKSCHED
+      uk_sched_yield();
+#endif
+    }
+  }
+  ubpf_destroy(vm);
+}
+
+// replace the program at index in place, so that tail calls into it never
+// find the slot empty; returns the previous program or NULL
+static struct ubpf_vm *bpf_prog_array_swap(uint64_t index, struct ubpf_vm *vm,
+                                           int *err) {
+  *err = 0;
+  for (struct THashCell *cell =
+           g_bpf_prog_array->m_Map[index % g_bpf_prog_array->m_Size];
+       cell != NULL; cell = cell->m_Next) {
+    if (cell->m_Key == index) {
+      struct ubpf_vm *old = cell->m_Value;
+      __atomic_store_n(&cell->m_Value, vm, __ATOMIC_RELEASE);
+      return old;
+    }
+  }
+  struct THmapValueResult *hmap_entry = hmap_put(g_bpf_prog_array, index, vm);
+  *err = hmap_entry == NULL || hmap_entry->m_Result != HMAP_SUCCESS;
+  free(hmap_entry);
+  return NULL;
+}
+
+struct THashMap *init_bpf_prog_array() {
+  int err = 0;
+  return hmap_init(31, &destruct_cell_prog, &create_cell_prog, &err);
+}
+
+// the VM treats this helper as a tail call: on success it continues in the
+// returned program and never comes back, see init_vm()
+uint64_t bpf_tail_call(void *ctx, uint64_t index) {
+  // runs on every tail call, so no allocation
+  return (uint64_t)hmap_find(g_bpf_prog_array, index);
+}
+
 // we put in function pointers so don't free the values
 void helper_list_destruct_entry(struct LabeledEntry *entry) {
   free(entry->m_Label);
@@ -164,12 +266,16 @@ struct ubpf_vm *init_vm(struct ArrayListWithLabels *helper_list,
     for (uint64_t i = 0; i < helper_list->m_Length; ++i) {
       struct LabeledEntry elem = helper_list->m_List[i];
       register_helper(function_index, elem.m_Label, elem.m_Value);
+      if (elem.m_Value == (void *)bpf_tail_call) {
+        ubpf_set_tail_call_function_index(vm, function_index);
+      }
       function_index++;
     }
   }
 
   register_helper(function_index, "bpf_unwind", bpf_unwind);
   ubpf_set_unwind_function_index(vm, function_index);
+  ubpf_set_stack_hook(vm, bpf_stack_hook);
   return vm;
 }
 
@@ -181,11 +287,36 @@ void *readfile(const char *path, size_t maxlen, size_t *len) {
     return NULL;
   }
 
-  char *data = calloc(maxlen, 1);
+  // size the buffer after the file instead of maxlen, the spare byte lets a
+  // regular file end in a short read. Anything else grows up to maxlen + 1.
+  struct stat st;
+  size_t capacity = 4096;
+  if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)) {
+    capacity = (size_t)st.st_size + 1;
+  }
+  if (capacity > maxlen + 1) {
+    capacity = maxlen + 1;
+  }
+
+  char *data = malloc(capacity);
   size_t offset = 0;
-  size_t rv;
-  while ((rv = fread(data + offset, 1, maxlen - offset, file)) > 0) {
-    offset += rv;
+  while (data != NULL) {
+    offset += fread(data + offset, 1, capacity - offset, file);
+    if (offset < capacity || offset > maxlen) {
+      break;
+    }
+    capacity = capacity * 2 > maxlen + 1 ? maxlen + 1 : capacity * 2;
+    char *grown = realloc(data, capacity);
+    if (grown == NULL) {
+      free(data);
+    }
+    data = grown;
+  }
+
+  if (data == NULL) {
+    fprintf(stderr, "Failed to allocate memory for %s\n", path);
+    fclose(file);
+    return NULL;
   }
 
   if (ferror(file)) {
@@ -195,7 +326,7 @@ void *readfile(const char *path, size_t maxlen, size_t *len) {
     return NULL;
   }
 
-  if (!feof(file)) {
+  if (offset > maxlen) {
     fprintf(stderr,
             "Failed to read %s because it is too large (max %u bytes)\n", path,
             (unsigned)maxlen);
@@ -211,6 +342,37 @@ void *readfile(const char *path, size_t maxlen, size_t *len) {
   return (void *)data;
 }
 
+void *read_bpf_program(const char *path, size_t *len,
+                       void (*print_fn)(char *str)) {
+  // reject malformed programs before reading them
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    wrap_print_fn(128 + strlen(path), ERR("Can't open %s: %s\n"), path,
+                  strerror(errno));
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size == 0 || size % 8 != 0) {
+    wrap_print_fn(128 + strlen(path),
+                  ERR("Invalid BPF program %s (%lu bytes).\n"), path,
+                  (unsigned long)size);
+    return NULL;
+  }
+  // the validator takes less than UBPF_MAX_INSTS instructions
+  if (size / 8 >= UBPF_MAX_INSTS) {
+    wrap_print_fn(128 + strlen(path),
+                  ERR("BPF program %s has too many instructions (%lu, max "
+                      "%u).\n"),
+                  path, (unsigned long)(size / 8), UBPF_MAX_INSTS - 1);
+    return NULL;
+  }
+  void *code = readfile(path, size, len);
+  if (code == NULL) {
+    wrap_print_fn(128 + strlen(path), ERR("Can't read %s.\n"), path);
+  }
+  return code;
+}
+
 int bpf_exec(const char *filename, void *args, size_t args_size, int debug,
              void (*print_fn)(char *str)) {
   FILE *logfile = NULL;
@@ -226,13 +388,15 @@ int bpf_exec(const char *filename, void *args, size_t args_size, int debug,
     fprintf(logfile, "\n");
   }
 
-  struct ubpf_vm *vm = init_vm(NULL, logfile);
   size_t code_len;
-  void *code = readfile(filename, 1024 * 1024, &code_len);
+  void *code = read_bpf_program(filename, &code_len, print_fn);
   if (code == NULL) {
-    fclose(logfile);
+    if (logfile != NULL) {
+      fclose(logfile);
+    }
     return 1;
   }
+  struct ubpf_vm *vm = init_vm(NULL, logfile);
   char *errmsg;
   int rv;
   rv = ubpf_load(vm, code, code_len, &errmsg);
@@ -254,7 +418,12 @@ int bpf_exec(const char *filename, void *args, size_t args_size, int debug,
   }
 
   uint64_t ret;
-  if (ubpf_exec(vm, args, args_size, &ret) < 0) {
+  bpf_probe_read_cache_flush();
+  struct bpf_stack_range saved;
+  bpf_prog_run_begin(&saved);
+  rv = ubpf_exec(vm, args, args_size, &ret);
+  bpf_prog_run_end(&saved);
+  if (rv < 0) {
     print_fn(ERR("BPF program execution failed.\n"));
     if (logfile != NULL) {
       fprintf(logfile, "BPF program execution failed.\n");
@@ -272,30 +441,176 @@ int bpf_exec(const char *filename, void *args, size_t args_size, int debug,
   return 0;
 }
 
+int bpf_prog_array_set(uint64_t index, const char *filename,
+                       void (*print_fn)(char *str)) {
+  if (filename == NULL)
+    return 1;
+
+  size_t code_len;
+  void *code = read_bpf_program(filename, &code_len, print_fn);
+  if (code == NULL) {
+    return 2;
+  }
+
+  struct ubpf_vm *vm = init_vm(NULL, NULL);
+  char *errmsg;
+  int rv = ubpf_load(vm, code, code_len, &errmsg);
+  free(code);
+#ifdef UBPF_TRACER_JIT
+  // jitted programs can only tail call into jitted programs
+  if (rv == 0 && ubpf_compile(vm, &errmsg) == NULL) {
+    rv = -1;
+  }
+#endif
+  if (rv < 0) {
+    size_t buf_size = 100 + strlen(errmsg);
+    wrap_print_fn(buf_size, ERR("Failed to load code: %s\n"), errmsg);
+    free(errmsg);
+    ubpf_destroy(vm);
+    return 3;
+  }
+
+  if (g_bpf_prog_array == NULL) {
+    g_bpf_prog_array = init_bpf_prog_array();
+  }
+  int err;
+  struct ubpf_vm *old_vm = bpf_prog_array_swap(index, vm, &err);
+  if (err) {
+    print_fn(ERR("Can't access prog_array.\n"));
+    ubpf_destroy(vm);
+    return 4;
+  }
+  if (old_vm != NULL) {
+    bpf_prog_array_retire(old_vm);
+  }
+
+  wrap_print_fn(128, YAY("prog_array[%lu] = %s\n"), index, filename);
+  return 0;
+}
+
+int bpf_prog_array_del(uint64_t index, void (*print_fn)(char *str)) {
+  if (g_bpf_prog_array == NULL) {
+    print_fn(ERR("prog_array is empty.\n"));
+    return 1;
+  }
+  struct THmapValueResult *hmap_entry = hmap_get(g_bpf_prog_array, index);
+  struct ubpf_vm *vm =
+      hmap_entry->m_Result == HMAP_SUCCESS ? hmap_entry->m_Value : NULL;
+  free(hmap_entry);
+  if (vm == NULL) {
+    wrap_print_fn(128, ERR("prog_array[%lu] is not set.\n"), index);
+    return 2;
+  }
+  free(hmap_del(g_bpf_prog_array, index));
+  bpf_prog_array_retire(vm);
+  wrap_print_fn(128, YAY("prog_array[%lu] was removed.\n"), index);
+  return 0;
+}
+
 uint64_t bpf_get_addr(const char *function_name) {
   void *ushell_symbol_get(const char *symbol);
   uint64_t fun_addr = (uint64_t)ushell_symbol_get(function_name);
   return fun_addr;
 }
 
-uint64_t bpf_probe_read(uint64_t addr, uint64_t size) {
-  if (size != 1 && size != 4 && size != 8) {
-    debug("bpf_probe_read: invalid size %lu\n", size);
-    return 0;
+// Page translations looked up by the probe_read helpers. Entries are only
+// trusted within one program run: bpf_probe_read_cache_flush() bumps the
+// epoch before every run, so a mapping change between two probe hits is never
+// missed, while the 8-byte reads of a struct within one run cost one walk.
+#define PROBE_READ_CACHE_SIZE 16
+#define PTE_PRESENT 0x1
+
+struct probe_read_cache_entry {
+  uint64_t page;
+  uint64_t pte;
+  uint64_t epoch;
+};
+
+struct probe_read_cache {
+  uint64_t epoch;
+  struct probe_read_cache_entry entries[PROBE_READ_CACHE_SIZE];
+};
+
+static struct probe_read_cache probe_read_cache[UBPF_TRACER_MAX_CPUS];
+
+static struct probe_read_cache *probe_read_cache_get() {
+  return &probe_read_cache[tracer_cpu_id()];
+}
+
+void bpf_probe_read_cache_flush() { probe_read_cache_get()->epoch++; }
+
+// returns the pte of the page containing addr, or 0 if it is not mapped
+static uint64_t probe_read_pte(struct probe_read_cache *cache, uint64_t addr) {
+  uint64_t page_addr = addr & ~0xfffULL;
+  struct probe_read_cache_entry *entry =
+      &cache->entries[(page_addr >> 12) % PROBE_READ_CACHE_SIZE];
+  if (entry->epoch == cache->epoch && entry->page == page_addr) {
+    return entry->pte;
   }
 
-  /* check if addr is valid */
   struct uk_pagetable;
   int ukplat_pt_walk(struct uk_pagetable *, uint64_t, uint64_t *, uint64_t *, uint64_t *);
   struct uk_pagetable *ukplat_pt_get_active(void);
   struct uk_pagetable *pt = ukplat_pt_get_active();
-  int rc;
-  uint64_t page_addr = addr & ~0xfffULL;
   uint64_t pte = 0;
-  rc = ukplat_pt_walk(pt, page_addr, NULL, NULL, &pte);
-  if (rc != 0 || (pte & 1) == 0) {
-    // invalid address
-    debug("bpf_probe_read: invalid addr %lu, %lu, %lu\n", addr, page_addr, pte);
+  if (ukplat_pt_walk(pt, page_addr, NULL, NULL, &pte) != 0 ||
+      (pte & PTE_PRESENT) == 0) {
+    pte = 0;
+  }
+
+  // unmapped pages are cached too, repeated reads of a bad pointer are cheap
+  entry->page = page_addr;
+  entry->pte = pte;
+  entry->epoch = cache->epoch;
+  return pte;
+}
+
+// check that every page of [addr, addr + size) is mapped with pte_flags
+static int probe_read_range_ok(uint64_t addr, uint64_t size,
+                               uint64_t pte_flags) {
+  if (size == 0 || addr + size < addr) {
+    return 0;
+  }
+
+  struct probe_read_cache *cache = probe_read_cache_get();
+  uint64_t last_page = (addr + size - 1) & ~0xfffULL;
+  for (uint64_t page = addr & ~0xfffULL; page <= last_page; page += 0x1000) {
+    if ((probe_read_pte(cache, page) & pte_flags) != pte_flags) {
+      debug("bpf_probe_read: invalid addr %lu, %lu\n", addr, page);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Follow the saved frame pointers from frame: [frame] is the caller's frame,
+// [frame + 8] the return address into it. Stops at the first frame that is
+// unmapped or doesn't move up the stack, returns the number of addresses.
+uint64_t tracer_stack_walk(uint64_t frame, uint64_t *ips, uint64_t max) {
+  uint64_t n = 0;
+  while (n < max && frame != 0 && frame % 8 == 0 &&
+         probe_read_range_ok(frame, 2 * sizeof(uint64_t), PTE_PRESENT)) {
+    uint64_t next = ((uint64_t *)frame)[0];
+    uint64_t ip = ((uint64_t *)frame)[1];
+    if (ip == 0) {
+      break;
+    }
+    ips[n++] = ip;
+    if (next <= frame) {
+      break;
+    }
+    frame = next;
+  }
+  return n;
+}
+
+uint64_t bpf_probe_read(uint64_t addr, uint64_t size) {
+  if (size != 1 && size != 4 && size != 8) {
+    debug("bpf_probe_read: invalid size %lu\n", size);
+    return 0;
+  }
+
+  if (!probe_read_range_ok(addr, size, PTE_PRESENT)) {
     return 0;
   }
 
@@ -308,15 +623,327 @@ uint64_t bpf_probe_read(uint64_t addr, uint64_t size) {
   return *(uint64_t*)addr;
 }
 
+uint64_t bpf_probe_read_bytes(void *dst, uint64_t size, uint64_t src) {
+  // dst is the BPF stack, a single frame bounds the copy
+  if (size > UBPF_STACK_SIZE) {
+    debug("bpf_probe_read_bytes: invalid size %lu\n", size);
+    return UINT64_MAX;
+  }
+
+  if (!bpf_stack_range_ok((uint64_t)dst, size)) {
+    debug("bpf_probe_read_bytes: dst %p is not on the BPF stack\n", dst);
+    return UINT64_MAX;
+  }
+
+  if (!probe_read_range_ok(src, size, PTE_PRESENT)) {
+    // don't leave stale stack contents behind for the program to use
+    memset(dst, 0, size);
+    return UINT64_MAX;
+  }
+
+  memcpy(dst, (void *)src, size);
+  return 0;
+}
+
+uint64_t bpf_read_pmc(uint64_t idx) {
+#ifdef CONFIG_LIBPMU
+  if (idx < PMU_MAX_COUNTERS) {
+    return pmu_read(idx);
+  }
+#endif
+  return 0;
+}
+
 uint64_t bpf_time_get_ns() {
   uint64_t ukplat_monotonic_clock(void);
   return ukplat_monotonic_clock();
 }
 
-// TODO:
-// - check size, null termination
-// - support format string
+// bpf_printk records go to a per-CPU ring and are formatted by the reader
+// (bpf_trace_print), the probe only copies the arguments. Format strings are
+// built on the BPF stack, so they are interned by content: a record keeps
+// the index of its format in trace_formats. A program builds its format at
+// the same stack address on every run, so each CPU remembers the index of
+// the last formats it saw by address and only compares the string again.
+#define TRACE_BUF_SIZE 4096 // records per CPU, power of two
+#define TRACE_MAX_FORMATS 64
+#define TRACE_FMT_MAX 128
+#define TRACE_MAX_ARGS 4
+#define TRACE_FMT_CACHE 8 // formats remembered per CPU, power of two
+
+// Slots are claimed by a cmpxchg on trace_nr_formats and filled by the CPU
+// that claimed them, which then sets ready. Slots that aren't ready yet are
+// skipped, at worst a format gets two slots.
+struct trace_format {
+  uint64_t hash;
+  uint64_t len;
+  uint64_t ready;
+  char str[TRACE_FMT_MAX];
+};
+
+struct trace_format_cache {
+  const char *fmt; // address of the format in the last run
+  uint64_t format; // its index in trace_formats
+};
+
+// seq is head + 1 of the write that filled the record, 0 while it's written
+struct trace_record {
+  uint64_t seq;
+  uint64_t ts;
+  uint64_t format;
+  uint64_t args[TRACE_MAX_ARGS];
+};
+
+// Only the owning CPU writes head and the records, only the reader
+// (bpf_trace_print) writes tail and lost. The writer overwrites the oldest
+// records without looking at tail, the reader notices from seq that a record
+// was overwritten while it copied it.
+struct trace_buffer {
+  uint64_t head; // next record to write
+  uint64_t tail; // next record to read
+  uint64_t lost; // overwritten before they were read
+  struct trace_format_cache cache[TRACE_FMT_CACHE];
+  struct trace_record records[TRACE_BUF_SIZE];
+};
+
+static struct trace_format trace_formats[TRACE_MAX_FORMATS];
+static uint64_t trace_nr_formats;
+static struct trace_buffer trace_buffers[UBPF_TRACER_MAX_CPUS];
+
+// only integer conversions, the arguments are raw 64-bit values
+static int trace_format_ok(const char *fmt) {
+  int args = 0;
+  for (const char *p = fmt; *p != '\0'; ++p) {
+    if (*p != '%') {
+      continue;
+    }
+    ++p;
+    if (*p == '%') {
+      continue;
+    }
+    while (*p == '-' || *p == '0' || *p == '#' || *p == ' ' ||
+           (*p >= '0' && *p <= '9')) {
+      ++p;
+    }
+    while (*p == 'l') {
+      ++p;
+    }
+    if (strchr("diuxXcp", *p) == NULL || *p == '\0') {
+      return 0;
+    }
+    if (++args > TRACE_MAX_ARGS) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// length of the string at str if it is mapped and shorter than max, or
+// UINT64_MAX
+static uint64_t probe_strnlen(const char *str, uint64_t max) {
+  for (uint64_t len = 0; len < max; ++len) {
+    if (((uint64_t)str + len) % 0x1000 == 0 || len == 0) {
+      if (!probe_read_range_ok((uint64_t)str + len, 1, PTE_PRESENT)) {
+        return UINT64_MAX;
+      }
+    }
+    if (str[len] == '\0') {
+      return len;
+    }
+  }
+  return UINT64_MAX;
+}
+
+// index of fmt in trace_formats, added if needed, or UINT64_MAX
+static uint64_t trace_format_intern(const char *fmt) {
+  uint64_t len = probe_strnlen(fmt, TRACE_FMT_MAX);
+  if (len == UINT64_MAX) {
+    return UINT64_MAX;
+  }
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (uint64_t i = 0; i < len; ++i) {
+    hash = (hash ^ (uint8_t)fmt[i]) * 0x100000001b3ULL;
+  }
+
+  uint64_t n = __atomic_load_n(&trace_nr_formats, __ATOMIC_ACQUIRE);
+  for (uint64_t i = 0; i < n; ++i) {
+    struct trace_format *format = &trace_formats[i];
+    if (__atomic_load_n(&format->ready, __ATOMIC_ACQUIRE) &&
+        format->hash == hash && format->len == len &&
+        memcmp(format->str, fmt, len) == 0) {
+      return i;
+    }
+  }
+
+  char str[TRACE_FMT_MAX];
+  memcpy(str, fmt, len);
+  str[len] = '\0';
+  if (!trace_format_ok(str)) {
+    return UINT64_MAX;
+  }
+  do {
+    if (n == TRACE_MAX_FORMATS) {
+      return UINT64_MAX;
+    }
+  } while (!__atomic_compare_exchange_n(&trace_nr_formats, &n, n + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  struct trace_format *format = &trace_formats[n];
+  memcpy(format->str, str, len + 1);
+  format->hash = hash;
+  format->len = len;
+  __atomic_store_n(&format->ready, 1, __ATOMIC_RELEASE);
+  return n;
+}
+
+// trace_format_intern through the CPU's cache: a format on the BPF stack at a
+// remembered address only needs a compare with the interned string
+static uint64_t trace_format_lookup(struct trace_buffer *tb, const char *fmt) {
+  struct trace_format_cache *entry =
+      &tb->cache[((uint64_t)fmt / sizeof(uint64_t)) % TRACE_FMT_CACHE];
+  if (entry->fmt == fmt) {
+    const struct trace_format *format = &trace_formats[entry->format];
+    if (bpf_stack_range_ok((uint64_t)fmt, format->len + 1) &&
+        memcmp(format->str, fmt, format->len + 1) == 0) {
+      return entry->format;
+    }
+  }
+  uint64_t format = trace_format_intern(fmt);
+  if (format != UINT64_MAX) {
+    entry->fmt = fmt;
+    entry->format = format;
+  }
+  return format;
+}
+
+// Record fmt and up to 4 integer arguments (%d, %i, %u, %x, %X, %c, %p with
+// an optional l/ll, width and flags) for bpf_trace_print. Returns 0, or
+// UINT64_MAX for a bad or new format when the format table is full. When the
+// ring is full the oldest record is overwritten.
+uint64_t bpf_printk(const char *fmt, uint64_t arg1, uint64_t arg2,
+                    uint64_t arg3, uint64_t arg4) {
+  struct trace_buffer *tb = &trace_buffers[tracer_cpu_id()];
+  uint64_t format = trace_format_lookup(tb, fmt);
+  if (format == UINT64_MAX) {
+    return UINT64_MAX;
+  }
+
+  uint64_t head = tb->head;
+  struct trace_record *record = &tb->records[head % TRACE_BUF_SIZE];
+  __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->ts = bpf_time_get_ns();
+  record->format = format;
+  record->args[0] = arg1;
+  record->args[1] = arg2;
+  record->args[2] = arg3;
+  record->args[3] = arg4;
+  __atomic_store_n(&record->seq, head + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&tb->head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// format one record, each conversion gets its argument with the type given
+// by its length modifier
+static void trace_record_format(const struct trace_record *record, char *buf,
+                                size_t size) {
+  const char *fmt = trace_formats[record->format].str;
+  size_t len = 0;
+  int arg = 0;
+  char spec[16];
+
+  buf[0] = '\0';
+  for (const char *p = fmt; *p != '\0' && len + 1 < size;) {
+    if (*p != '%' || p[1] == '%') {
+      buf[len++] = *p;
+      p += *p == '%' ? 2 : 1;
+      continue;
+    }
+    const char *start = p++;
+    int longs = 0;
+    while (strchr("-0# 123456789", *p) != NULL && *p != '\0') {
+      ++p;
+    }
+    while (*p == 'l') {
+      ++longs;
+      ++p;
+    }
+    size_t spec_len = (size_t)(p - start) + 1;
+    if (spec_len >= sizeof(spec)) {
+      break;
+    }
+    memcpy(spec, start, spec_len);
+    spec[spec_len] = '\0';
+    uint64_t value = record->args[arg++];
+    int n;
+    if (*p == 'p') {
+      n = snprintf(buf + len, size - len, spec, (void *)value);
+    } else if (longs > 0) {
+      n = snprintf(buf + len, size - len, spec, (unsigned long)value);
+    } else {
+      n = snprintf(buf + len, size - len, spec, (unsigned int)value);
+    }
+    if (n < 0) {
+      break;
+    }
+    len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    ++p;
+  }
+  buf[len] = '\0';
+}
+
+// copy the record at tb->tail into record unless the writer has overwritten
+// it or is writing it, both change its seq
+static int trace_record_copy(struct trace_buffer *tb,
+                             struct trace_record *record) {
+  const struct trace_record *slot = &tb->records[tb->tail % TRACE_BUF_SIZE];
+  uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  *record = *slot;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return seq == tb->tail + 1 &&
+         __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+// There is only one reader: the shell runs its commands one after another.
+int bpf_trace_print(void (*print_fn)(char *str)) {
+  char buf[256];
+  char line[300];
+  struct trace_record record;
+  for (unsigned int cpu = 0; cpu < UBPF_TRACER_MAX_CPUS; ++cpu) {
+    struct trace_buffer *tb = &trace_buffers[cpu];
+    uint64_t head;
+    while ((head = __atomic_load_n(&tb->head, __ATOMIC_ACQUIRE)) != tb->tail) {
+      if (head - tb->tail > TRACE_BUF_SIZE) {
+        tb->lost += head - tb->tail - TRACE_BUF_SIZE;
+        tb->tail = head - TRACE_BUF_SIZE;
+      }
+      if (!trace_record_copy(tb, &record)) {
+        tb->lost++;
+        tb->tail++;
+        continue;
+      }
+      tb->tail++;
+      trace_record_format(&record, buf, sizeof(buf));
+      snprintf(line, sizeof(line), "[%u] %lu.%09lu: %s\n", cpu,
+               record.ts / 1000000000, record.ts % 1000000000, buf);
+      print_fn(line);
+    }
+    if (tb->lost > 0) {
+      snprintf(line, sizeof(line), ERR("cpu %u: lost %lu records\n"), cpu,
+               tb->lost);
+      print_fn(line);
+      tb->lost = 0;
+    }
+  }
+  return 0;
+}
+
+// Print the string at buf if it is mapped and ends within UBPF_STACK_SIZE
+// bytes, it is usually built on the BPF stack. Use bpf_printk for formatted
+// output.
 void bpf_puts(char *buf) {
   void ushell_puts(char *);
+  if (probe_strnlen(buf, UBPF_STACK_SIZE) == UINT64_MAX) {
+    return;
+  }
   ushell_puts(buf);
 }
@@ -1,5 +1,10 @@
 #include "ubpf_tracer.h"
 
+#if defined(UBPF_TRACER_STATS) && defined(CONFIG_LIBUKSTORE)
+#include <uk/alloc.h>
+#include <uk/store.h>
+#endif
+
 static const uint8_t nopl[] = {0x0f, 0x1f, 0x44, 0x00, 0x00};
 
 void bpf_notify(void *function_id) {
@@ -52,8 +57,15 @@ void vm_map_destruct_cell(struct THashCell *elem) {
   destruct_cell(elem);
 }
 
+static void probe_store_add(struct UbpfTracerProbe *probe,
+                            const char *function_name,
+                            const char *bpf_filename);
+static void probe_store_del(struct UbpfTracerProbe *probe);
+
 void vm_map_destruct_entry(struct LabeledEntry *entry) {
-  ubpf_destroy(entry->m_Value);
+  struct UbpfTracerProbe *probe = entry->m_Value;
+  probe_store_del(probe);
+  ubpf_destroy(probe->vm);
   destruct_entry(entry);
 }
 
@@ -67,11 +79,19 @@ struct UbpfTracer *init_tracer() {
   tracer->nop_map = hmap_init(101, destruct_cell, nop_map_init, &map_result);
   tracer->function_names =
       hmap_init(101, destruct_cell, function_names_init, &map_result);
+  tracer->stack_map = hmap_init(101, destruct_cell, NULL, &map_result);
+  tracer->stack_map_dropped = 0;
   tracer->helper_list = init_helper_list();
 
   // register local helpers
   tracer_helpers_add(tracer, "bpf_notify", bpf_notify);
   tracer_helpers_add(tracer, "bpf_get_ret_addr", bpf_get_ret_addr);
+  tracer_helpers_add(tracer, "bpf_tail_call", bpf_tail_call);
+  tracer_helpers_add(tracer, "bpf_probe_read_bytes", bpf_probe_read_bytes);
+  tracer_helpers_add(tracer, "bpf_read_pmc", bpf_read_pmc);
+  tracer_helpers_add(tracer, "bpf_get_stack", bpf_get_stack);
+  tracer_helpers_add(tracer, "bpf_get_stackid", bpf_get_stackid);
+  tracer_helpers_add(tracer, "bpf_printk", bpf_printk);
 
   load_debug_symbols(tracer);
 
@@ -157,16 +177,28 @@ int bpf_attach_internal(struct UbpfTracer *tracer, const char *function_name,
   }
 
   size_t code_len;
-  void *bpf_program = readfile(bpf_filename, 1024 * 1024, &code_len);
+  void *bpf_program = read_bpf_program(bpf_filename, &code_len, print_fn);
   if (bpf_program == NULL) {
-    print_fn(ERR("Can't insert BPF program (file doesn't exist).\n"));
+    // read_bpf_program printed why
     return 3;
   }
-  // TODO: verify bpf_program here
 
   struct ubpf_vm *vm = init_vm(tracer->helper_list, NULL);
   char *errmsg;
-  ubpf_load(vm, bpf_program, code_len, &errmsg);
+  int rv = ubpf_load(vm, bpf_program, code_len, &errmsg);
+  free(bpf_program);
+#ifdef UBPF_TRACER_JIT
+  if (rv == 0 && ubpf_compile(vm, &errmsg) == NULL) {
+    rv = -1;
+  }
+#endif
+  if (rv < 0) {
+    size_t buf_size = 100 + strlen(errmsg);
+    wrap_print_fn(buf_size, ERR("Failed to load code: %s\n"), errmsg);
+    free(errmsg);
+    ubpf_destroy(vm);
+    return 4;
+  }
 
   struct THmapValueResult *hmap_entry = hmap_get_or_create(
       tracer->vm_map, (uint64_t)nop_addr + CALL_INSTRUCTION_SIZE);
@@ -174,9 +206,10 @@ int bpf_attach_internal(struct UbpfTracer *tracer, const char *function_name,
     struct ArrayListWithLabels *list = hmap_entry->m_Value;
     bool nop_already_replaced = list->m_Length > 0;
 
-    char *label = malloc(strlen(bpf_filename));
-    strcpy(label, bpf_filename);
-    list_add_elem(list, label, vm);
+    struct UbpfTracerProbe *probe = calloc(1, sizeof(struct UbpfTracerProbe));
+    probe->vm = vm;
+    list_add_elem(list, bpf_filename, probe);
+    probe_store_add(probe, function_name, bpf_filename);
 
     if (!nop_already_replaced) {
       extern void _run_bpf_program();
@@ -269,42 +302,397 @@ uint64_t find_nop_address(struct UbpfTracer *tracer, const char *function_name,
   return (uint64_t)nopl_addr;
 }
 
-uint64_t ubpf_tracer_save_rax;
-uint64_t ubpf_tracer_ret_addr;
-void run_bpf_program() {
-  // uint64_t ret_addr = (uint64_t)__builtin_return_address(0);
+// Decide whether a hit runs the program. Unsampled probes pay one
+// compare, sampled ones a decrement; the clock is only read once the
+// rate limit's tokens for the current one second window are used up.
+// The state is per CPU, so probes hit on several CPUs don't race.
+static inline bool probe_should_run(struct UbpfTracerProbe *probe,
+                                    unsigned int cpu) {
+  struct UbpfTracerProbeSampling *sampling = &probe->sampling[cpu];
+  if (probe->sample_every > 1) {
+    if (--sampling->sample_countdown != 0) {
+      return false;
+    }
+    sampling->sample_countdown = probe->sample_every;
+  }
 
-  // find vm in the vm_map
-  struct THmapValueResult *hmap_entry =
-      hmap_get(get_tracer()->vm_map, ubpf_tracer_ret_addr);
-  if (hmap_entry->m_Result == HMAP_SUCCESS) {
-    struct ArrayListWithLabels *list = hmap_entry->m_Value;
-    for (uint64_t i = 0; i < list->m_Length; ++i) {
-      size_t ctx_size = sizeof(struct UbpfTracerCtx);
-      struct UbpfTracerCtx ctx = {};
-      ctx.traced_function_address = ubpf_tracer_ret_addr;
+  if (probe->rate_limit != 0) {
+    if (sampling->rate_tokens == 0) {
+      uint64_t now = bpf_time_get_ns();
+      if (now - sampling->rate_window_ns < 1000000000ULL) {
+        return false;
+      }
+      sampling->rate_window_ns = now;
+      sampling->rate_tokens = probe->rate_limit;
+    }
+    sampling->rate_tokens--;
+  }
+  return true;
+}
+
+static inline void probe_stats_add(struct UbpfTracerProbeStats *stats,
+                                   uint64_t ns, uint32_t instructions,
+                                   bool failed) {
+  stats->runs++;
+  stats->total_ns += ns;
+  if (ns > stats->max_ns) {
+    stats->max_ns = ns;
+  }
+  stats->instructions += instructions;
+  stats->errors += failed;
+}
 
-      struct LabeledEntry list_item = list->m_List[i];
-      struct ubpf_vm *vm = list_item.m_Value;
+// add the per-CPU counters of probe to sum, max_ns is the maximum
+void probe_stats_sum(const struct UbpfTracerProbe *probe,
+                     struct UbpfTracerProbeStats *sum) {
+  for (unsigned int cpu = 0; cpu < UBPF_TRACER_MAX_CPUS; ++cpu) {
+    const struct UbpfTracerProbeStats *stats = &probe->stats[cpu];
+    sum->hits += stats->hits;
+    sum->runs += stats->runs;
+    sum->total_ns += stats->total_ns;
+    if (stats->max_ns > sum->max_ns) {
+      sum->max_ns = stats->max_ns;
+    }
+    sum->instructions += stats->instructions;
+    sum->errors += stats->errors;
+  }
+}
 
-      uint64_t ret;
-      if (ubpf_exec(vm, &ctx, ctx_size, &ret) < 0)
-        ret = UINT64_MAX;
+// counters of all attached programs
+void tracer_stats_sum(struct UbpfTracer *tracer,
+                      struct UbpfTracerProbeStats *sum) {
+  memset(sum, 0, sizeof(*sum));
+  for (size_t i = 0; i < tracer->vm_map->m_Size; ++i) {
+    for (struct THashCell *current = tracer->vm_map->m_Map[i]; current != NULL;
+         current = current->m_Next) {
+      struct ArrayListWithLabels *list = current->m_Value;
+      for (uint64_t j = 0; j < list->m_Length; ++j) {
+        probe_stats_sum(list->m_List[j].m_Value, sum);
+      }
     }
   }
+}
+
+#if defined(UBPF_TRACER_STATS) && defined(CONFIG_LIBUKSTORE)
+// libubpf_tracer/probe_<field>, summed over all attached programs
+#define TRACER_STORE_ENTRY(field)                                              \
+  static int tracer_store_##field(void *cookie __unused, __u64 *dst) {         \
+    struct UbpfTracerProbeStats sum;                                           \
+    tracer_stats_sum(get_tracer(), &sum);                                      \
+    *dst = sum.field;                                                          \
+    return 0;                                                                  \
+  }                                                                            \
+  UK_STORE_STATIC_ENTRY(probe_##field, u64, tracer_store_##field, NULL, NULL)
+
+// <field> of the uk_store object of one attached program, the cookie is the
+// probe
+#define PROBE_STORE_ENTRY(field)                                               \
+  static int probe_store_##field(void *cookie, __u64 *dst) {                   \
+    struct UbpfTracerProbeStats sum = {};                                      \
+    probe_stats_sum(cookie, &sum);                                             \
+    *dst = sum.field;                                                          \
+    return 0;                                                                  \
+  }                                                                            \
+  UK_STORE_ENTRY(probe_store_entry_##field, #field, u64, probe_store_##field,  \
+                 NULL)
+
+TRACER_STORE_ENTRY(hits);
+TRACER_STORE_ENTRY(runs);
+TRACER_STORE_ENTRY(total_ns);
+TRACER_STORE_ENTRY(max_ns);
+TRACER_STORE_ENTRY(errors);
+PROBE_STORE_ENTRY(hits);
+PROBE_STORE_ENTRY(runs);
+PROBE_STORE_ENTRY(total_ns);
+PROBE_STORE_ENTRY(max_ns);
+PROBE_STORE_ENTRY(errors);
+#ifndef UBPF_TRACER_JIT
+// jitted code doesn't count them
+TRACER_STORE_ENTRY(instructions);
+PROBE_STORE_ENTRY(instructions);
+#endif
+
+// export the stats of probe as the uk_store object <function>:<program>
+static void probe_store_add(struct UbpfTracerProbe *probe,
+                            const char *function_name,
+                            const char *bpf_filename) {
+  char name[128];
+  snprintf(name, sizeof(name), "%s:%s", function_name, bpf_filename);
+  struct uk_store_object *obj = uk_store_obj_alloc(
+      uk_alloc_get_default(), name, probe, &probe_store_entry_hits,
+      &probe_store_entry_runs, &probe_store_entry_total_ns,
+      &probe_store_entry_max_ns, &probe_store_entry_errors
+#ifndef UBPF_TRACER_JIT
+      ,
+      &probe_store_entry_instructions
+#endif
+  );
+  // the stats are still shown by bpf_list
+  if (obj == NULL) {
+    return;
+  }
+  if (uk_store_obj_add(obj) < 0) {
+    uk_store_obj_release(obj);
+    return;
+  }
+  probe->store = obj;
+}
+
+static void probe_store_del(struct UbpfTracerProbe *probe) {
+  if (probe->store != NULL) {
+    uk_store_obj_release(probe->store);
+    probe->store = NULL;
+  }
+}
+#else
+static void probe_store_add(struct UbpfTracerProbe *probe,
+                            const char *function_name,
+                            const char *bpf_filename) {}
+static void probe_store_del(struct UbpfTracerProbe *probe) {}
+#endif
+
+// the probe hit handled on each CPU, cleared outside of probes
+struct tracer_hit {
+  uint64_t ret_addr; // after the call in the traced function
+  uint64_t frame;    // %rbp of the traced function
+};
+static struct tracer_hit tracer_hits[UBPF_TRACER_MAX_CPUS];
+// the programs attached at ret_addr
+static struct ArrayListWithLabels *probe_list_get(struct THashMap *vm_map,
+                                                  uint64_t ret_addr) {
+  return hmap_find(vm_map, ret_addr);
+}
+
+// called by _run_bpf_program (ubpf_tracer_trampoline.S) on every probe hit
+void run_bpf_program(uint64_t ret_addr, uint64_t frame) {
+  struct ArrayListWithLabels *list =
+      probe_list_get(get_tracer()->vm_map, ret_addr);
+  if (list == NULL) {
+    return;
+  }
+
+  // a probe can hit in a function called by a helper of another probe
+  unsigned int cpu = tracer_cpu_id();
+  struct tracer_hit outer_hit = tracer_hits[cpu];
+  tracer_hits[cpu].ret_addr = ret_addr;
+  tracer_hits[cpu].frame = frame;
+
+  struct bpf_stack_range saved;
+  bool running = false;
+  for (uint64_t i = 0; i < list->m_Length; ++i) {
+    struct UbpfTracerProbe *probe = list->m_List[i].m_Value;
+#ifdef UBPF_TRACER_STATS
+    struct UbpfTracerProbeStats *stats = &probe->stats[cpu];
+    stats->hits++;
+#endif
+    // skipped hits return before anything else is set up
+    if (!probe_should_run(probe, cpu)) {
+      continue;
+    }
+    if (!running) {
+      bpf_probe_read_cache_flush();
+      bpf_prog_run_begin(&saved);
+      running = true;
+    }
+
+    size_t ctx_size = sizeof(struct UbpfTracerCtx);
+    struct UbpfTracerCtx ctx = {};
+    ctx.traced_function_address = ret_addr;
+    struct ubpf_vm *vm = probe->vm;
+
+#ifdef UBPF_TRACER_STATS
+    uint64_t start_ns = bpf_time_get_ns();
+#endif
+    uint64_t ret;
+    uint32_t instructions = 0;
+    bool failed;
+#ifdef UBPF_TRACER_JIT
+    // already compiled by bpf_attach
+    failed = ubpf_exec_jit(vm, &ctx, ctx_size, &ret) < 0;
+#else
+    failed = ubpf_exec_count(vm, &ctx, ctx_size, &ret, &instructions) < 0;
+#endif
+#ifdef UBPF_TRACER_STATS
+    probe_stats_add(stats, bpf_time_get_ns() - start_ns, instructions,
+                    failed);
+#else
+    (void)failed;
+    (void)instructions;
+#endif
+  }
+  if (running) {
+    bpf_prog_run_end(&saved);
+  }
+  tracer_hits[cpu] = outer_hit;
+}
+
+// the call chain of the current probe hit: the traced function, then the
+// return addresses found by following the frame pointers (the traced code is
+// built with -pg, which keeps them)
+static uint64_t tracer_get_stack(uint64_t *ips, uint64_t max) {
+  const struct tracer_hit *hit = &tracer_hits[tracer_cpu_id()];
+  if (hit->frame == 0 || max == 0) {
+    return 0;
+  }
+  ips[0] = hit->ret_addr;
+  return 1 + tracer_stack_walk(hit->frame, ips + 1, max - 1);
+}
+
+// Copy up to size / 8 addresses of the call chain into buf (the BPF stack),
+// returns the number of addresses or UINT64_MAX.
+uint64_t bpf_get_stack(void *buf, uint64_t size) {
+  if (size > UBPF_STACK_SIZE || !bpf_stack_range_ok((uint64_t)buf, size)) {
+    return UINT64_MAX;
+  }
+  uint64_t max = size / sizeof(uint64_t);
+  if (max > TRACER_STACK_MAX_DEPTH) {
+    max = TRACER_STACK_MAX_DEPTH;
+  }
+  return tracer_get_stack(buf, max);
+}
+
+// Store the call chain (at most max_depth frames, 0 = TRACER_STACK_MAX_DEPTH)
+// in the stack map and return its id. Identical stacks get the same id, so
+// counting by id in bpf_map gives flame graph data, see bpf_stacks().
+// Returns UINT64_MAX if the map is full or another stack has the same id.
+uint64_t bpf_get_stackid(uint64_t max_depth) {
+  struct TracerStack stack;
+  if (max_depth == 0 || max_depth > TRACER_STACK_MAX_DEPTH) {
+    max_depth = TRACER_STACK_MAX_DEPTH;
+  }
+  stack.nr = tracer_get_stack(stack.ips, max_depth);
+  if (stack.nr == 0) {
+    return UINT64_MAX;
+  }
+
+  // FNV-1a over the addresses
+  uint64_t id = 0xcbf29ce484222325ULL;
+  for (uint64_t i = 0; i < stack.nr; ++i) {
+    id = (id ^ stack.ips[i]) * 0x100000001b3ULL;
+  }
+  id &= INT64_MAX;
+
+  struct UbpfTracer *tracer = get_tracer();
+  // seen stacks are the common case, look them up without allocating
+  struct TracerStack *stored = hmap_find(tracer->stack_map, id);
+  if (stored != NULL) {
+    if (stored->nr != stack.nr ||
+        memcmp(stored->ips, stack.ips, stack.nr * sizeof(uint64_t)) != 0) {
+      tracer->stack_map_dropped++;
+      return UINT64_MAX;
+    }
+    return id;
+  }
+
+  if (tracer->stack_map->m_Elems >= TRACER_STACK_MAP_MAX) {
+    tracer->stack_map_dropped++;
+    return UINT64_MAX;
+  }
+  size_t stack_size = offsetof(struct TracerStack, ips[stack.nr]);
+  stored = malloc(stack_size);
+  if (stored == NULL) {
+    tracer->stack_map_dropped++;
+    return UINT64_MAX;
+  }
+  memcpy(stored, &stack, stack_size);
+  struct THmapValueResult *hmap_entry = hmap_put(tracer->stack_map, id, stored);
+  if (hmap_entry == NULL) {
+    free(stored);
+    tracer->stack_map_dropped++;
+    return UINT64_MAX;
+  }
+  if (hmap_entry->m_Result != HMAP_SUCCESS) {
+    free(stored);
+    id = UINT64_MAX;
+  }
   free(hmap_entry);
+  return id;
+}
+
+// name of the symbol containing addr, the symbol table isn't sorted
+static const char *tracer_symbolize(struct UbpfTracer *tracer, uint64_t addr) {
+  const struct DebugInfo *best = NULL;
+  for (uint32_t i = 0; i < tracer->symbols_cnt; ++i) {
+    const struct DebugInfo *sym = &tracer->symbols[i];
+    if (sym->address <= addr && (best == NULL || sym->address > best->address)) {
+      best = sym;
+    }
+  }
+  return best != NULL ? best->identifier : "[unknown]";
+}
+
+// Print the stored stacks in the folded format of flamegraph.pl, outermost
+// frame first, with the count bpf_map[count_key][stack_id].
+int bpf_stacks_internal(struct UbpfTracer *tracer, uint64_t count_key,
+                        void (*print_fn)(char *str)) {
+  size_t buf_size = 64 * (TRACER_STACK_MAX_DEPTH + 1);
+  char *buf = malloc(buf_size);
+  if (buf == NULL) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < tracer->stack_map->m_Size; ++i) {
+    for (struct THashCell *current = tracer->stack_map->m_Map[i];
+         current != NULL; current = current->m_Next) {
+      const struct TracerStack *stack = current->m_Value;
+      uint64_t count = bpf_map_get(count_key, current->m_Key);
+      if (count == UINT64_MAX) {
+        continue;
+      }
+      int len = 0;
+      for (uint64_t j = stack->nr; j > 0 && (size_t)len < buf_size; --j) {
+        len += snprintf(buf + len, buf_size - len, "%s%s",
+                        j == stack->nr ? "" : ";",
+                        tracer_symbolize(tracer, stack->ips[j - 1]));
+      }
+      if ((size_t)len < buf_size) {
+        snprintf(buf + len, buf_size - len, " %lu\n", count);
+      }
+      print_fn(buf);
+    }
+  }
+  free(buf);
+
+  if (tracer->stack_map_dropped > 0) {
+    wrap_print_fn(128, ERR("%lu stacks were dropped (max %d).\n"),
+                  tracer->stack_map_dropped, TRACER_STACK_MAP_MAX);
+  }
+  return 0;
 }
 
 void prog_list_print(const char *function_name,
                      const struct ArrayListWithLabels *list,
                      void (*print_fn)(char *str)) {
-  size_t buf_size = 100 * (list->m_Length + 1);
+  size_t buf_size = 300 * (list->m_Length + 1);
   char *buf = calloc(buf_size, sizeof(char));
   int len = 0;
   len += snprintf(buf, buf_size - len, "%s:\n", function_name);
   for (size_t j = 0; j < list->m_Length; ++j) {
-    len += snprintf(buf + len, buf_size - len, "  - %s\n",
+    struct UbpfTracerProbe *probe = list->m_List[j].m_Value;
+    len += snprintf(buf + len, buf_size - len, "  - %s",
                     list->m_List[j].m_Label);
+    if (probe->sample_every > 1) {
+      len += snprintf(buf + len, buf_size - len, " (1 in %lu hits)",
+                      probe->sample_every);
+    }
+    if (probe->rate_limit != 0) {
+      len += snprintf(buf + len, buf_size - len, " (max %lu/s per CPU)",
+                      probe->rate_limit);
+    }
+    len += snprintf(buf + len, buf_size - len, "\n");
+#ifdef UBPF_TRACER_STATS
+    struct UbpfTracerProbeStats sum = {};
+    probe_stats_sum(probe, &sum);
+    char instructions[24] = "n/a"; // jitted code doesn't count them
+#ifndef UBPF_TRACER_JIT
+    snprintf(instructions, sizeof(instructions), "%lu", sum.instructions);
+#endif
+    len += snprintf(buf + len, buf_size - len,
+                    "      hits: %lu, runs: %lu, errors: %lu, instructions: "
+                    "%s, avg: %lu ns, max: %lu ns\n",
+                    sum.hits, sum.runs, sum.errors, instructions,
+                    sum.runs ? sum.total_ns / sum.runs : 0, sum.max_ns);
+#endif
   }
   print_fn(buf);
   free(buf);
@@ -383,6 +771,85 @@ int bpf_detach_internal(struct UbpfTracer *tracer, const char *function_name,
   return 0;
 }
 
+struct UbpfTracerProbe *find_probe(struct UbpfTracer *tracer,
+                                   const char *function_name,
+                                   const char *bpf_filename,
+                                   void (*print_fn)(char *str)) {
+  if (function_name == NULL || bpf_filename == NULL)
+    return NULL;
+
+  uint64_t fun_addr = get_function_address(tracer, function_name);
+  uint64_t nop_addr = fun_addr == 0 ? 0 : get_nop_address(tracer, fun_addr);
+  if (nop_addr == 0) {
+    print_fn(ERR("Function not traced.\n"));
+    return NULL;
+  }
+
+  struct UbpfTracerProbe *probe = NULL;
+  struct THmapValueResult *hmap_entry =
+      hmap_get(tracer->vm_map, nop_addr + CALL_INSTRUCTION_SIZE);
+  if (hmap_entry->m_Result == HMAP_SUCCESS) {
+    struct ArrayListWithLabels *list = hmap_entry->m_Value;
+    for (uint64_t i = 0; i < list->m_Length; ++i) {
+      if (strcmp(list->m_List[i].m_Label, bpf_filename) == 0) {
+        probe = list->m_List[i].m_Value;
+        break;
+      }
+    }
+  }
+  free(hmap_entry);
+
+  if (probe == NULL) {
+    wrap_print_fn(128 + strlen(bpf_filename),
+                  ERR("%s is not attached to the function.\n"), bpf_filename);
+  }
+  return probe;
+}
+
+int bpf_sample_internal(struct UbpfTracer *tracer, const char *function_name,
+                        const char *bpf_filename, uint64_t every,
+                        void (*print_fn)(char *str)) {
+  struct UbpfTracerProbe *probe =
+      find_probe(tracer, function_name, bpf_filename, print_fn);
+  if (probe == NULL)
+    return 1;
+
+  for (unsigned int cpu = 0; cpu < UBPF_TRACER_MAX_CPUS; ++cpu) {
+    probe->sampling[cpu].sample_countdown = every;
+  }
+  probe->sample_every = every;
+  if (every > 1) {
+    wrap_print_fn(128, YAY("Sampling 1 in %lu hits.\n"), every);
+  } else {
+    print_fn(YAY("Sampling disabled.\n"));
+  }
+  return 0;
+}
+
+int bpf_rate_limit_internal(struct UbpfTracer *tracer,
+                            const char *function_name,
+                            const char *bpf_filename, uint64_t per_second,
+                            void (*print_fn)(char *str)) {
+  struct UbpfTracerProbe *probe =
+      find_probe(tracer, function_name, bpf_filename, print_fn);
+  if (probe == NULL)
+    return 1;
+
+  uint64_t now = bpf_time_get_ns();
+  for (unsigned int cpu = 0; cpu < UBPF_TRACER_MAX_CPUS; ++cpu) {
+    probe->sampling[cpu].rate_tokens = per_second;
+    probe->sampling[cpu].rate_window_ns = now;
+  }
+  probe->rate_limit = per_second;
+  if (per_second != 0) {
+    wrap_print_fn(128, YAY("Rate limited to %lu runs per second.\n"),
+                  per_second);
+  } else {
+    print_fn(YAY("Rate limit disabled.\n"));
+  }
+  return 0;
+}
+
 int bpf_attach(const char *function_name, const char *bpf_filename,
                void (*print_fn)(char *str)) {
   return bpf_attach_internal(get_tracer(), function_name, bpf_filename,
@@ -399,3 +866,18 @@ int bpf_detach(const char *function_name, const char *bpf_filename,
                              print_fn);
 }
 
+int bpf_sample(const char *function_name, const char *bpf_filename,
+               uint64_t every, void (*print_fn)(char *str)) {
+  return bpf_sample_internal(get_tracer(), function_name, bpf_filename, every,
+                             print_fn);
+}
+
+int bpf_rate_limit(const char *function_name, const char *bpf_filename,
+                   uint64_t per_second, void (*print_fn)(char *str)) {
+  return bpf_rate_limit_internal(get_tracer(), function_name, bpf_filename,
+                                 per_second, print_fn);
+}
+
+int bpf_stacks(uint64_t count_key, void (*print_fn)(char *str)) {
+  return bpf_stacks_internal(get_tracer(), count_key, print_fn);
+}
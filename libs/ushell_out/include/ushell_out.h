@@ -0,0 +1,17 @@
+#ifndef USHELL_OUT_H
+#define USHELL_OUT_H
+
+#include <stddef.h>
+
+// Buffered output for ushell programs: the calls copy into a ring and return,
+// a background thread writes the ring to the console with ushell_puts_n().
+// They only block when the ring is full.
+size_t ushell_out_write(const char *buf, size_t len);
+size_t ushell_out_puts(const char *str);
+int ushell_out_printf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+// wait until everything written so far is on the console
+void ushell_out_flush(void);
+
+#endif /* USHELL_OUT_H */
@@ -0,0 +1,149 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/sched.h>
+#include <uk/wait.h>
+
+#include <ushell_out.h>
+
+#define USHELL_OUT_RING_SIZE CONFIG_LIBUSHELL_OUT_RING_SIZE
+// largest console write, the drain thread yields between them
+#define USHELL_OUT_CHUNK 1024
+#define USHELL_OUT_PRINTF_BUF 256
+
+UK_CTASSERT((USHELL_OUT_RING_SIZE & (USHELL_OUT_RING_SIZE - 1)) == 0);
+
+void ushell_puts_n(char *str, size_t len);
+
+static char ushell_out_ring[USHELL_OUT_RING_SIZE];
+// free running, the drain thread only moves tail after the console write
+static size_t ushell_out_head;
+static size_t ushell_out_tail;
+
+static struct uk_thread *ushell_out_thread;
+static int ushell_out_failed;
+static struct uk_waitq ushell_out_data_wq =
+    UK_WAIT_QUEUE_INITIALIZER(ushell_out_data_wq);
+static struct uk_waitq ushell_out_space_wq =
+    UK_WAIT_QUEUE_INITIALIZER(ushell_out_space_wq);
+
+static size_t ushell_out_used(void)
+{
+	return ushell_out_head - ushell_out_tail;
+}
+
+static void ushell_out_drain(void *arg __unused)
+{
+	for (;;) {
+		uk_waitq_wait_event(&ushell_out_data_wq, ushell_out_used() > 0);
+
+		size_t off = ushell_out_tail % USHELL_OUT_RING_SIZE;
+		size_t n = ushell_out_used();
+
+		if (n > USHELL_OUT_RING_SIZE - off)
+			n = USHELL_OUT_RING_SIZE - off;
+		if (n > USHELL_OUT_CHUNK)
+			n = USHELL_OUT_CHUNK;
+		ushell_puts_n(&ushell_out_ring[off], n);
+		ushell_out_tail += n;
+		// writers waiting for space and ushell_out_flush()
+		uk_waitq_wake_up(&ushell_out_space_wq);
+	}
+}
+
+// the drain thread is started with the first write
+static int ushell_out_start(void)
+{
+	if (ushell_out_thread != NULL)
+		return 0;
+	if (ushell_out_failed)
+		return -1;
+
+	ushell_out_thread =
+	    uk_thread_create("ushell_out", ushell_out_drain, NULL);
+	if (ushell_out_thread == NULL) {
+		ushell_out_failed = 1;
+		return -1;
+	}
+	return 0;
+}
+
+size_t ushell_out_write(const char *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (ushell_out_start() < 0) {
+		// no thread, write synchronously
+		ushell_puts_n((char *)buf, len);
+		return len;
+	}
+
+	while (done < len) {
+		size_t space = USHELL_OUT_RING_SIZE - ushell_out_used();
+
+		if (space == 0) {
+			uk_waitq_wake_up(&ushell_out_data_wq);
+			uk_waitq_wait_event(&ushell_out_space_wq,
+					    ushell_out_used()
+						< USHELL_OUT_RING_SIZE);
+			continue;
+		}
+
+		size_t off = ushell_out_head % USHELL_OUT_RING_SIZE;
+		size_t n = MIN(space, len - done);
+		size_t first = MIN(n, USHELL_OUT_RING_SIZE - off);
+
+		memcpy(&ushell_out_ring[off], buf + done, first);
+		memcpy(ushell_out_ring, buf + done + first, n - first);
+		ushell_out_head += n;
+		done += n;
+	}
+	// the thread runs once the caller yields or blocks
+	uk_waitq_wake_up(&ushell_out_data_wq);
+	return len;
+}
+
+size_t ushell_out_puts(const char *str)
+{
+	return ushell_out_write(str, strlen(str));
+}
+
+int ushell_out_printf(const char *fmt, ...)
+{
+	char buf[USHELL_OUT_PRINTF_BUF];
+	char *out = buf;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return len;
+
+	if ((size_t)len >= sizeof(buf)) {
+		out = malloc(len + 1);
+		if (out == NULL)
+			return -1;
+		va_start(ap, fmt);
+		vsnprintf(out, len + 1, fmt, ap);
+		va_end(ap);
+	}
+	ushell_out_write(out, len);
+	if (out != buf)
+		free(out);
+	return len;
+}
+
+void ushell_out_flush(void)
+{
+	if (ushell_out_thread == NULL)
+		return;
+
+	uk_waitq_wake_up(&ushell_out_data_wq);
+	uk_waitq_wait_event(&ushell_out_space_wq, ushell_out_used() == 0);
+}
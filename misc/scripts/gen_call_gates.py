@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Generate MPK call gates for the symbols in an exportsyms.uk.
+
+ushell programs call exported kernel functions directly; with MPK a callee
+that writes kernel memory faults unless the program opens the write domain
+first (unikraft_call_wrapper). Instead, every exported symbol that needs write
+access gets a gate that opens the domain (if it isn't open already), calls
+the symbol and closes it again. Symbols declared "none" in the requirements
+file are called directly and cost nothing. Symbols declared "wrap" get no gate
+either: the program calls them through unikraft_call_wrapper itself.
+
+    gen_call_gates.py exportsyms.uk gates.uk out/unikraft_gates
+
+writes out/unikraft_gates.S (the gates) and out/unikraft_gates.h, which
+renames the gated symbols to their gate. Programs include the header and are
+linked with the assembled gates (ld -r).
+
+The requirements file has one "<symbol> <write|none|wrap>" per line, '#'
+starts a comment. Exported symbols that are not listed need write access.
+
+Gates only forward the six integer argument registers (and %al for variadic
+calls) and the %rax:%rdx return value: functions with arguments on the stack
+or floating point arguments, and variadic functions that may get more than
+six arguments, have to be declared "wrap".
+"""
+
+import re
+import sys
+from pathlib import Path
+
+GATE_PREFIX = "__gate_"
+REQUIREMENTS = ("write", "none", "wrap")
+IDENTIFIER = re.compile(r"^[A-Za-z_][A-Za-z0-9_]*$")
+
+
+def read_lines(path):
+    for lineno, line in enumerate(Path(path).read_text().splitlines(), 1):
+        line = line.split("#", 1)[0].strip()
+        if line:
+            yield lineno, line
+
+
+def read_exportsyms(path):
+    symbols = []
+    for lineno, line in read_lines(path):
+        if not IDENTIFIER.match(line):
+            sys.exit(f"{path}:{lineno}: invalid symbol '{line}'")
+        symbols.append(line)
+    return symbols
+
+
+def read_requirements(path):
+    requirements = {}
+    if path is None or not Path(path).exists():
+        return requirements
+    for lineno, line in read_lines(path):
+        fields = line.split()
+        if len(fields) != 2 or fields[1] not in REQUIREMENTS:
+            sys.exit(f"{path}:{lineno}: expected '<symbol> <write|none|wrap>'")
+        requirements[fields[0]] = fields[1]
+    return requirements
+
+
+# The frame keeps the stack 16-byte aligned for the calls:
+#   -8 %rbx (callee saved, holds "domain was already open")
+#  -16..-56 argument registers, -64 %rax (vector count of variadic calls)
+GATE = """
+	.globl {gate}
+	.type {gate}, @function
+{gate}:
+	pushq %rbp
+	movq %rsp, %rbp
+	pushq %rbx
+	pushq %rdi
+	pushq %rsi
+	pushq %rdx
+	pushq %rcx
+	pushq %r8
+	pushq %r9
+	pushq %rax
+	call ushell_write_is_enabled@PLT
+	movl %eax, %ebx
+	testl %eax, %eax
+	jnz 1f
+	call ushell_enable_write@PLT
+1:
+	movq -16(%rbp), %rdi
+	movq -24(%rbp), %rsi
+	movq -32(%rbp), %rdx
+	movq -40(%rbp), %rcx
+	movq -48(%rbp), %r8
+	movq -56(%rbp), %r9
+	movq -64(%rbp), %rax
+	call {symbol}@PLT
+	testl %ebx, %ebx
+	jnz 2f
+	movq %rax, -16(%rbp)
+	movq %rdx, -24(%rbp)
+	call ushell_disable_write@PLT
+	movq -16(%rbp), %rax
+	movq -24(%rbp), %rdx
+2:
+	movq -8(%rbp), %rbx
+	leave
+	ret
+	.size {gate}, .-{gate}
+"""
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        sys.exit(f"usage: {sys.argv[0]} exportsyms.uk [gates.uk] out_prefix")
+    exportsyms = sys.argv[1]
+    requirements = read_requirements(sys.argv[2] if len(sys.argv) == 4 else None)
+    out = Path(sys.argv[-1])
+
+    symbols = read_exportsyms(exportsyms)
+    unknown = set(requirements) - set(symbols)
+    if unknown:
+        sys.exit(f"not in {exportsyms}: {', '.join(sorted(unknown))}")
+    gated = [s for s in symbols if requirements.get(s, "write") == "write"]
+
+    header = [
+        f"/* generated by gen_call_gates.py from {exportsyms}, do not edit */",
+        "#ifndef UNIKRAFT_GATES_H",
+        "#define UNIKRAFT_GATES_H",
+        "",
+        "#ifdef HAS_MPK",
+    ]
+    header += [f"#define {s} {GATE_PREFIX}{s}" for s in gated]
+    header += ["#endif /* HAS_MPK */", "", "#endif /* UNIKRAFT_GATES_H */", ""]
+
+    asm = [f"/* generated by gen_call_gates.py from {exportsyms}, do not edit */"]
+    asm.append("\t.text")
+    asm += [GATE.format(gate=GATE_PREFIX + s, symbol=s) for s in gated]
+    asm.append('\t.section .note.GNU-stack,"",@progbits')
+
+    out.parent.mkdir(parents=True, exist_ok=True)
+    out.with_suffix(".h").write_text("\n".join(header))
+    out.with_suffix(".S").write_text("\n".join(asm) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Restore and compact the delta files of apps/common/include/sqlite_delta.h.
+
+A delta file is a full snapshot of a database followed by snapshots of the
+chunks written since the previous one.
+
+    sqlite_delta.py info dump.delta
+    sqlite_delta.py restore dump.delta dump.db
+    sqlite_delta.py compact dump.delta compacted.delta
+
+restore replays all complete snapshots into a database file. compact writes
+a delta file with a single snapshot of the same state, which the guest can
+keep appending to. A snapshot that was cut short (no trailer) ends the replay.
+"""
+
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = b"SQLDELTA"
+VERSION = 1
+SNAP = 0x50414E53
+DONE = 0x454E4F44
+HEADER = struct.Struct("<8sII")
+SNAP_HEADER = struct.Struct("<IIQQ")
+TRAILER = struct.Struct("<II")
+OFFSET = struct.Struct("<Q")
+
+
+def read_snapshots(path):
+    """yield (seq, db_size, [(offset, chunk)]) of the complete snapshots"""
+    data = Path(path).read_bytes()
+    if len(data) < HEADER.size:
+        sys.exit(f"{path}: not a delta file")
+    magic, version, chunk_size = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        sys.exit(f"{path}: not a delta file (version {VERSION})")
+
+    pos = HEADER.size
+    while pos < len(data):
+        if pos + SNAP_HEADER.size > len(data):
+            break
+        magic, nr, seq, db_size = SNAP_HEADER.unpack_from(data, pos)
+        if magic != SNAP:
+            sys.exit(f"{path}: bad snapshot at offset {pos}")
+        end = pos + SNAP_HEADER.size + nr * (OFFSET.size + chunk_size)
+        if end + TRAILER.size > len(data):
+            break
+        done, done_nr = TRAILER.unpack_from(data, end)
+        if done != DONE or done_nr != nr:
+            break
+        chunks = []
+        p = pos + SNAP_HEADER.size
+        for _ in range(nr):
+            (offset,) = OFFSET.unpack_from(data, p)
+            p += OFFSET.size
+            chunks.append((offset, data[p : p + chunk_size]))
+            p += chunk_size
+        yield seq, db_size, chunks
+        pos = end + TRAILER.size
+    if pos < len(data):
+        print(f"{path}: ignoring incomplete snapshot at offset {pos}", file=sys.stderr)
+
+
+def chunk_size_of(path):
+    with open(path, "rb") as f:
+        return HEADER.unpack(f.read(HEADER.size))[2]
+
+
+def replay(path):
+    image = bytearray()
+    last = None
+    for seq, db_size, chunks in read_snapshots(path):
+        for offset, chunk in chunks:
+            if len(image) < offset + len(chunk):
+                image.extend(bytes(offset + len(chunk) - len(image)))
+            image[offset : offset + len(chunk)] = chunk
+        del image[db_size:]
+        last = seq
+    if last is None:
+        sys.exit(f"{path}: no complete snapshot")
+    return last, image
+
+
+def info(path):
+    total = 0
+    for seq, db_size, chunks in read_snapshots(path):
+        size = sum(len(c) for _, c in chunks)
+        total += size
+        print(f"snapshot {seq}: {len(chunks)} chunks ({size // 1024} KiB), database {db_size // 1024} KiB")
+    print(f"{total // 1024} KiB of chunks")
+
+
+def restore(path, out):
+    seq, image = replay(path)
+    Path(out).write_bytes(image)
+    print(f"{out}: snapshot {seq}, {len(image)} bytes")
+
+
+def compact(path, out):
+    chunk_size = chunk_size_of(path)
+    seq, image = replay(path)
+    nr = (len(image) + chunk_size - 1) // chunk_size
+    with open(out, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, chunk_size))
+        f.write(SNAP_HEADER.pack(SNAP, nr, seq, len(image)))
+        for i in range(nr):
+            chunk = image[i * chunk_size : (i + 1) * chunk_size]
+            f.write(OFFSET.pack(i * chunk_size))
+            f.write(chunk + bytes(chunk_size - len(chunk)))
+        f.write(TRAILER.pack(DONE, nr))
+    print(f"{out}: snapshot {seq}, {nr} chunks")
+
+
+def main():
+    commands = {"info": (info, 1), "restore": (restore, 2), "compact": (compact, 2)}
+    if len(sys.argv) < 2 or sys.argv[1] not in commands:
+        sys.exit(__doc__)
+    func, nargs = commands[sys.argv[1]]
+    if len(sys.argv) != nargs + 2:
+        sys.exit(__doc__)
+    func(*sys.argv[2:])
+
+
+if __name__ == "__main__":
+    main()
@@ -5,7 +5,7 @@ from pylib import unwrap, unsafe_cast
 from procs import run
 import root
 
-from typing import List, Any, Optional, Callable, Iterator, Tuple
+from typing import List, Any, Optional, Callable, Iterator, Tuple, Dict
 import time
 import socket as s
 import select
@@ -14,6 +14,7 @@ from tqdm import tqdm
 from tempfile import TemporaryDirectory
 from pathlib import Path
 import numpy as np
+import pandas as pd
 import threading
 from contextlib import contextmanager
 import shutil
@@ -56,6 +57,8 @@ def sample(f: Callable[[], Any], size: int = SIZE, warmup: int = WARMUP) -> List
 
 
 STATS_PATH = MEASURE_RESULTS.joinpath("app-stats.json")
+# latency percentiles, kept apart since they have their own units and plots
+LATENCY_STATS_PATH = MEASURE_RESULTS.joinpath("app-latency-stats.json")
 
 def readconsole(ushell: s.socket) -> str:
     fd = ushell.fileno()
@@ -254,7 +257,10 @@ def redis_bench(
     payload_size: int = 3,
     keepalive: int = 1,
     pipelining: int = 16,
-) -> Tuple[float, float]:
+) -> Tuple[float, float, Dict[str, Dict[str, float]]]:
+    """
+    @return (set rps, get rps, {"set"/"get": latency percentiles in ns})
+    """
     queries: str = "get,set"  # changing this probably changes output parsing
     cmd = [
         "taskset",
@@ -292,7 +298,17 @@ def redis_bench(
     get = float(data[2][1])
     # line = re.findall("^Requests/sec:.*$", result.stdout, flags=re.MULTILINE)[0]
     # value = float(line.split(" ")[-1]) # requests / second
-    return (set_, get)
+
+    # redis-benchmark >= 6.2 adds latency columns: avg_latency_ms, p50_latency_ms, ...
+    latency: Dict[str, Dict[str, float]] = {}
+    header = data[0]
+    for row, test in ((data[1], "set"), (data[2], "get")):
+        latency[test] = {}
+        for column, value in zip(header, row):
+            if column.endswith("_latency_ms"):
+                key = column[: -len("_latency_ms")].replace("avg", "mean")
+                latency[test][key] = float(value) * 1e6
+    return (set_, get, latency)
 
 
 def redis_ushell(
@@ -316,7 +332,7 @@ def redis_ushell(
         print(f"skip {name}")
         return
 
-    def experiment() -> Tuple[float, float]:
+    def experiment() -> Tuple[float, float, Dict[str, Dict[str, float]]]:
         ushell = s.socket(s.AF_UNIX)
 
         # with util.testbench_console(helpers) as vm:
@@ -385,7 +401,7 @@ def redis_ushell(
     sets = []
     gets = []
 
-    for (a, b) in samples:
+    for (a, b, _) in samples:
         sets += [a]
         gets += [b]
 
@@ -393,6 +409,10 @@ def redis_ushell(
     stats[name_get] = gets
     util.write_stats(STATS_PATH, stats)
 
+    latency_stats = util.read_stats(LATENCY_STATS_PATH)
+    util.add_latency_stats(latency_stats, name, [c for (_, _, c) in samples])
+    util.write_stats(LATENCY_STATS_PATH, latency_stats)
+
 
 # sqlite benchmark
 def sqlite_ushell(
@@ -416,7 +436,7 @@ def sqlite_ushell(
         print(f"skip {name}")
         return
 
-    def experiment() -> float:
+    def experiment() -> Tuple[float, Dict[str, Dict[str, float]]]:
         ushell = s.socket(s.AF_UNIX)
 
         # with util.testbench_console(helpers) as vm:
@@ -438,15 +458,20 @@ def sqlite_ushell(
                 vm.wait_for_death()
             ushell.close()
             with open(log, "r") as f:
-                sec = float(f.readlines()[-1])
+                lines = f.readlines()
+                sec = float(lines[-1])
                 print(f"sql operations took {sec}")
-                return sec
+                return (sec, util.parse_latency_hist("".join(lines)))
 
     samples = sample(lambda: experiment())
 
-    stats[name] = samples
+    stats[name] = [sec for (sec, _) in samples]
     util.write_stats(STATS_PATH, stats)
 
+    latency_stats = util.read_stats(LATENCY_STATS_PATH)
+    util.add_latency_stats(latency_stats, name, [hist for (_, hist) in samples])
+    util.write_stats(LATENCY_STATS_PATH, latency_stats)
+
 
 def nginx_ushell(
     helpers: confmeasure.Helpers,
@@ -768,6 +793,17 @@ def calculate_average_overhead(stats):
         }
 
 
+def export_latency() -> None:
+    """
+    app-latency.tsv: one column per <benchmark>-<workload>-<percentile> (ns)
+    """
+    latency_stats = util.read_stats(LATENCY_STATS_PATH)
+    if len(latency_stats) == 0:
+        return
+    # workloads may be missing from some samples, pad with NaN
+    util.export_fio("app-latency", {k: pd.Series(v) for k, v in latency_stats.items()})
+
+
 def check_requirements():
     util.check_intel_turbo()
     util.check_hyperthreading()
@@ -823,6 +859,7 @@ def main_old() -> None:
     util.export_fio("app", stats)
     means = calculate_average_overhead(stats)
     util.export_fio("app-mean", means)
+    export_latency()
 
 def main(all_: bool = False) -> None:
     """all_: run all measurements, not just the ones used in the paper
@@ -905,6 +942,7 @@ def main(all_: bool = False) -> None:
 
     # Export results
     util.export_fio("app", stats)
+    export_latency()
 
 if __name__ == "__main__":
     from argparse import ArgumentParser
@@ -205,3 +205,64 @@ def write_stats(path: Path, stats: Dict[str, List]) -> None:
             indent=4,
             sort_keys=True,
         )
+
+
+def parse_latency_hist(output: str) -> Dict[str, Dict[str, float]]:
+    """
+    Read the "hist <name> count=<n> p50=<ns> ..." summaries printed by
+    apps/common/include/latency_hist.h.
+    @return {name: {"count": n, "p50": ns, ...}}
+    """
+    hists: Dict[str, Dict[str, float]] = {}
+    for line in output.splitlines():
+        fields = line.strip().split()
+        if len(fields) < 2 or fields[0] != "hist":
+            continue
+        values = {}
+        for field in fields[2:]:
+            key, sep, value = field.partition("=")
+            if sep:
+                values[key] = float(value)
+        hists[fields[1]] = values
+    return hists
+
+
+def add_latency_stats(
+    stats: Dict[str, List], name: str, hists: List[Dict[str, Dict[str, float]]]
+) -> None:
+    """
+    Store the percentiles of all samples as <name>-<workload>-<percentile>,
+    one list entry per sample like the other stats. Entries of a previous
+    run of name are replaced, like stats[name] = samples.
+    """
+    new: Dict[str, List] = {}
+    for hist in hists:
+        for workload, values in hist.items():
+            for key, value in values.items():
+                if key.startswith("p") or key in ("min", "mean", "max"):
+                    new.setdefault(f"{name}-{workload}-{key}", []).append(value)
+    stats.update(new)
+
+
+def parse_memtel(output: str) -> pd.DataFrame:
+    """
+    Read the allocator samples printed by memtel_dump (libs/memtel), e.g.
+    captured from the ushell console, into a frame with one row per sample.
+    Rows from several dumps are merged by seq.
+    """
+    header: Optional[List[str]] = None
+    rows: Dict[int, List[Any]] = {}
+    for line in output.splitlines():
+        fields = line.strip().split("\t")
+        if len(fields) < 2 or fields[0] != "memtel":
+            continue
+        if fields[1] == "seq":
+            header = fields[1:]
+            continue
+        if header is None or len(fields) - 1 != len(header):
+            continue
+        row: List[Any] = [f if name == "event" else int(f) for name, f in zip(header, fields[1:])]
+        rows[int(fields[1])] = row
+    if header is None:
+        return pd.DataFrame()
+    return pd.DataFrame([rows[k] for k in sorted(rows)], columns=header)